@@ -0,0 +1,344 @@
+///
+/// per-stage microbenchmarks of the encoder, every stage runs in isolation on the
+/// output of the previous ones, computed before timing. Images: synthetic ones of
+/// several sizes, plus every image file given on the command line, e.g.
+///   ./jpeg_bench data/sg_0.png --benchmark_filter=fdct
+/// bytes_per_second counts the input bytes of a stage, time/block the time per 8x8
+/// block it handles (blocks of all three components).
+///
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "JpegEncoder.hpp"
+#include "JpegColor.hpp"
+#include "JpegDCT.hpp"
+#include "JpegQuant.hpp"
+#include "JpegZigzag.hpp"
+#include "JpegProgressive.hpp"
+#include "HuffmanCodec.hpp"
+#include "JpegBitWriter.hpp"
+#include "JpegIO.hpp"
+#include "image.hpp"
+
+namespace {
+
+struct BenchImage {
+    std::string name;
+    Image<uint8_t> synthetic;
+    StbImage decoded;
+    ImageView<uint8_t> rgb;
+};
+typedef std::shared_ptr<BenchImage> BenchImagePtr;
+
+/// smooth gradients with some noise, about the statistics of a photo
+BenchImagePtr syntheticImage(const int rows, const int cols) {
+    BenchImagePtr image = std::make_shared<BenchImage>();
+    image->name = "synthetic_" + std::to_string(cols) + "x" + std::to_string(rows);
+    image->synthetic = Image<uint8_t>(rows, cols, 3);
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<int> noise(-12, 12);
+    for (int y = 0; y < rows; ++y) {
+        uint8_t* px = image->synthetic.row(y);
+        for (int x = 0; x < cols; ++x, px += 3) {
+            px[0] = std::max(0, std::min(255, y * 255 / rows + noise(gen)));
+            px[1] = std::max(0, std::min(255, x * 255 / cols + noise(gen)));
+            px[2] = std::max(0, std::min(255, (x + y) * 127 / (rows + cols) + 64 + noise(gen)));
+        }
+    }
+    image->rgb = image->synthetic;
+    return image;
+}
+
+BenchImagePtr fileImage(const std::string &path) {
+    BenchImagePtr image = std::make_shared<BenchImage>();
+    image->name = path.substr(path.find_last_of('/') + 1);
+    image->decoded = StbImage(path.c_str());
+    image->rgb = image->decoded.view();
+    return image;
+}
+
+/// the blocks and coefficients of an image after each stage, computed once per benchmark
+struct Planes {
+    int sx, sy;
+    size_t yCount, cCount;
+    std::vector<uint8_t> y, u, v;            // 8x8 sample blocks
+    AlignedVector<int16_t> yDct, uDct, vDct; // DCT, natural order
+    AlignedVector<int16_t> yZz, uZz, vZz;    // quantized, zigzag order
+    JpegQuant quant;
+
+    Planes(const ImageView<uint8_t> &rgb, YUVFormat format): quant(75, true) {
+        sx = format == YUVFormat::YUV444 ? 1 : 2;
+        sy = format == YUVFormat::YUV420 ? 2 : 1;
+        JpegColor::rgbToBlocks(rgb, y, u, v, 8 * sx, 8 * sy, sx, sy);
+        yCount = y.size() / 64;
+        cCount = u.size() / 64;
+        yDct.resize(y.size()); uDct.resize(u.size()); vDct.resize(v.size());
+        JpegDCT::fdctBlocks(y.data(), yDct.data(), yCount);
+        JpegDCT::fdctBlocks(u.data(), uDct.data(), cCount);
+        JpegDCT::fdctBlocks(v.data(), vDct.data(), cCount);
+        yZz.resize(y.size()); uZz.resize(u.size()); vZz.resize(v.size());
+        quant.quantZigzagBlocks(yDct.data(), yZz.data(), yCount, true);
+        quant.quantZigzagBlocks(uDct.data(), uZz.data(), cCount, false);
+        quant.quantZigzagBlocks(vDct.data(), vZz.data(), cCount, false);
+    }
+    size_t blocks() const { return yCount + 2 * cCount; }
+};
+
+void setRates(benchmark::State &state, const size_t bytes, const size_t blocks) {
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(bytes));
+    // the inverse of the block rate, printed with its SI prefix (e.g. 45.2ns)
+    state.counters["time/block"] = benchmark::Counter(double(blocks),
+        benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+size_t pixelBytes(const ImageView<uint8_t> &rgb) { return rgb.rows() * rgb.cols() * 3; }
+
+void BM_ColorConvert(benchmark::State &state, BenchImagePtr image) {
+    const ImageView<uint8_t> &rgb = image->rgb;
+    std::vector<uint8_t> y(rgb.cols()), cb(rgb.cols()), cr(rgb.cols());
+    for (auto _ : state) {
+        for (size_t r = 0; r < rgb.rows(); ++r) {
+            JpegColor::rgbRowToYCbCr(rgb.row(r), y.data(), cb.data(), cr.data(), rgb.cols());
+        }
+        benchmark::DoNotOptimize(y.data());
+        benchmark::ClobberMemory();
+    }
+    setRates(state, pixelBytes(rgb), 3 * ((rgb.rows() + 7) / 8) * ((rgb.cols() + 7) / 8));
+}
+
+void BM_ColorConvertScalar(benchmark::State &state, BenchImagePtr image) {
+    const ImageView<uint8_t> &rgb = image->rgb;
+    std::vector<uint8_t> y(rgb.cols()), cb(rgb.cols()), cr(rgb.cols());
+    for (auto _ : state) {
+        for (size_t r = 0; r < rgb.rows(); ++r) {
+            JpegColor::rgbRowToYCbCrScalar(rgb.row(r), y.data(), cb.data(), cr.data(), rgb.cols());
+        }
+        benchmark::DoNotOptimize(y.data());
+        benchmark::ClobberMemory();
+    }
+    setRates(state, pixelBytes(rgb), 3 * ((rgb.rows() + 7) / 8) * ((rgb.cols() + 7) / 8));
+}
+
+/// color conversion, chroma subsampling and blocking, fused as the encoder runs them
+void BM_Sampling(benchmark::State &state, BenchImagePtr image, YUVFormat format) {
+    const ImageView<uint8_t> &rgb = image->rgb;
+    const int sx = format == YUVFormat::YUV444 ? 1 : 2;
+    const int sy = format == YUVFormat::YUV420 ? 2 : 1;
+    const size_t cCount = JpegColor::blockCount(rgb.cols(), rgb.rows(), 8 * sx, 8 * sy);
+    std::vector<uint8_t> y(64 * cCount * sx * sy), u(64 * cCount), v(64 * cCount), scratch;
+    for (auto _ : state) {
+        JpegColor::rgbToBlocks(rgb, y.data(), u.data(), v.data(), 8 * sx, 8 * sy, sx, sy, scratch);
+        benchmark::DoNotOptimize(y.data());
+        benchmark::ClobberMemory();
+    }
+    setRates(state, pixelBytes(rgb), cCount * (sx * sy + 2));
+}
+
+void BM_FDCT(benchmark::State &state, BenchImagePtr image) {
+    Planes planes(image->rgb, YUVFormat::YUV420);
+    for (auto _ : state) {
+        JpegDCT::fdctBlocks(planes.y.data(), planes.yDct.data(), planes.yCount);
+        JpegDCT::fdctBlocks(planes.u.data(), planes.uDct.data(), planes.cCount);
+        JpegDCT::fdctBlocks(planes.v.data(), planes.vDct.data(), planes.cCount);
+        benchmark::DoNotOptimize(planes.yDct.data());
+        benchmark::ClobberMemory();
+    }
+    setRates(state, 64 * planes.blocks(), planes.blocks());
+}
+
+void BM_FDCTScalar(benchmark::State &state, BenchImagePtr image) {
+    Planes planes(image->rgb, YUVFormat::YUV420);
+    for (auto _ : state) {
+        for (size_t b = 0; b < planes.yCount; ++b) {
+            JpegDCT::fdct8x8Scalar(planes.y.data() + 64 * b, planes.yDct.data() + 64 * b);
+        }
+        for (size_t b = 0; b < planes.cCount; ++b) {
+            JpegDCT::fdct8x8Scalar(planes.u.data() + 64 * b, planes.uDct.data() + 64 * b);
+            JpegDCT::fdct8x8Scalar(planes.v.data() + 64 * b, planes.vDct.data() + 64 * b);
+        }
+        benchmark::DoNotOptimize(planes.yDct.data());
+        benchmark::ClobberMemory();
+    }
+    setRates(state, 64 * planes.blocks(), planes.blocks());
+}
+
+/// quantization with the zigzag reordering fused in
+void BM_Quantize(benchmark::State &state, BenchImagePtr image) {
+    Planes planes(image->rgb, YUVFormat::YUV420);
+    for (auto _ : state) {
+        planes.quant.quantZigzagBlocks(planes.yDct.data(), planes.yZz.data(), planes.yCount, true);
+        planes.quant.quantZigzagBlocks(planes.uDct.data(), planes.uZz.data(), planes.cCount, false);
+        planes.quant.quantZigzagBlocks(planes.vDct.data(), planes.vZz.data(), planes.cCount, false);
+        benchmark::DoNotOptimize(planes.yZz.data());
+        benchmark::ClobberMemory();
+    }
+    setRates(state, 64 * sizeof(int16_t) * planes.blocks(), planes.blocks());
+}
+
+/// the standalone zigzag reordering of int blocks
+void BM_Zigzag(benchmark::State &state, BenchImagePtr image) {
+    Planes planes(image->rgb, YUVFormat::YUV420);
+    std::vector<int> blocks(planes.yDct.begin(), planes.yDct.end());
+    blocks.insert(blocks.end(), planes.uDct.begin(), planes.uDct.end());
+    blocks.insert(blocks.end(), planes.vDct.begin(), planes.vDct.end());
+    JpegZigzag zigzag;
+    for (auto _ : state) {
+        for (size_t b = 0; b < planes.blocks(); ++b) {
+            zigzag.zigzag(blocks.data() + 64 * b);
+        }
+        benchmark::DoNotOptimize(blocks.data());
+        benchmark::ClobberMemory();
+    }
+    setRates(state, 64 * sizeof(int) * planes.blocks(), planes.blocks());
+}
+
+/// entropy coding of every block (encodeBlock through the incremental interface)
+void BM_HuffmanBlocks(benchmark::State &state, BenchImagePtr image) {
+    Planes planes(image->rgb, YUVFormat::YUV420);
+    HuffmanCodec codec;
+    const size_t mcus = planes.cCount;
+    size_t scanBytes = 0;
+    for (auto _ : state) {
+        codec.beginScan(HuffmanCodec::MAX_BLOCK_BYTES * planes.blocks() + HuffmanCodec::WRITER_SLACK_BYTES);
+        codec.encodeMcus(planes.yZz.data(), planes.uZz.data(), planes.vZz.data(), mcus, YUVFormat::YUV420);
+        scanBytes = codec.finishScan();
+        benchmark::DoNotOptimize(scanBytes);
+    }
+    setRates(state, 64 * sizeof(int16_t) * planes.blocks(), planes.blocks());
+    state.counters["scan_bytes"] = double(scanBytes);
+}
+
+/// statistics pass and optimal tables of optimized Huffman coding
+void BM_HuffmanOptimize(benchmark::State &state, BenchImagePtr image) {
+    Planes planes(image->rgb, YUVFormat::YUV420);
+    HuffmanCodec codec;
+    for (auto _ : state) {
+        codec.optimizeTables(planes.yZz.data(), planes.uZz.data(), planes.vZz.data(),
+                             image->rgb.cols(), image->rgb.rows(), YUVFormat::YUV420);
+        benchmark::DoNotOptimize(codec.huffmanTable(false, true));
+    }
+    setRates(state, 64 * sizeof(int16_t) * planes.blocks(), planes.blocks());
+}
+
+/// both passes of every scan of the default progressive script
+void BM_Progressive(benchmark::State &state, BenchImagePtr image) {
+    Planes planes(image->rgb, YUVFormat::YUV420);
+    JpegProgressive coder;
+    const std::vector<JpegScan> script = JpegProgressive::defaultScript();
+    long scanBytes = 0;
+    for (auto _ : state) {
+        scanBytes = coder.encode(planes.yZz.data(), planes.uZz.data(), planes.vZz.data(),
+                                 image->rgb.cols(), image->rgb.rows(), YUVFormat::YUV420, script);
+        benchmark::DoNotOptimize(scanBytes);
+    }
+    setRates(state, 64 * sizeof(int16_t) * planes.blocks(), planes.blocks());
+    state.counters["scan_bytes"] = double(scanBytes);
+}
+
+/// the bit writer alone: codes of 1..27 bits, the lengths of Huffman codes with extra bits
+void BM_BitWriter(benchmark::State &state) {
+    const size_t count = size_t(1) << 16;
+    std::mt19937 gen(11);
+    std::vector<uint32_t> bits(count);
+    std::vector<int> lengths(count);
+    size_t totalBits = 0;
+    for (size_t i = 0; i < count; ++i) {
+        lengths[i] = 1 + gen() % 27;
+        bits[i] = gen() & ((1u << lengths[i]) - 1);
+        totalBits += lengths[i];
+    }
+    std::vector<uint8_t> buffer(2 * (totalBits / 8) + 64);
+    JpegBitWriter writer;
+    for (auto _ : state) {
+        writer.reset(buffer.data(), buffer.size());
+        for (size_t i = 0; i < count; ++i) {
+            writer.putBits(bits[i], lengths[i]);
+        }
+        benchmark::DoNotOptimize(writer.flush());
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(totalBits / 8));
+    state.counters["time/put"] = benchmark::Counter(double(count),
+        benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+/// SOI, DQT, SOF0, DHT and SOS with the standard tables
+void BM_Header(benchmark::State &state) {
+    JpegQuant quant(75, true);
+    const int* pqtab[2] = {quant.qtable_lumin.data(), quant.qtable_chrom.data()};
+    const uint8_t* huf_ac_tab[2] = {HuffmanCodec::STD_HUFTAB_LUMIN_AC, HuffmanCodec::STD_HUFTAB_CHROM_AC};
+    const uint8_t* huf_dc_tab[2] = {HuffmanCodec::STD_HUFTAB_LUMIN_DC, HuffmanCodec::STD_HUFTAB_CHROM_DC};
+    uint8_t header[JpegIO::MAX_HEADER_SIZE];
+    size_t size = 0;
+    for (auto _ : state) {
+        size = JpegIO::writeHeader(header, pqtab, huf_ac_tab, huf_dc_tab, 1920, 1080, YUVFormat::YUV420);
+        benchmark::DoNotOptimize(header);
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(size));
+}
+
+/// all stages, into memory, for reference
+void BM_Encode(benchmark::State &state, BenchImagePtr image, YUVFormat format) {
+    JpegEncoder encoder;
+    encoder.setVerbose(false);
+    const size_t capacity = JpegEncoder::maxEncodedSize(image->rgb.cols(), image->rgb.rows(), format);
+    std::vector<uint8_t> jpeg(capacity);
+    long size = 0;
+    for (auto _ : state) {
+        size = encoder.encodeToBuffer(image->rgb, 75, format, jpeg.data(), jpeg.size());
+        benchmark::DoNotOptimize(size);
+    }
+    const int sx = format == YUVFormat::YUV444 ? 1 : 2;
+    const int sy = format == YUVFormat::YUV420 ? 2 : 1;
+    const size_t cCount = JpegColor::blockCount(image->rgb.cols(), image->rgb.rows(), 8 * sx, 8 * sy);
+    setRates(state, pixelBytes(image->rgb), cCount * (sx * sy + 2));
+    state.counters["jpeg_bytes"] = double(size);
+}
+
+void registerStages(const BenchImagePtr &image) {
+    const std::string suffix = "/" + image->name;
+    auto add = [&](const std::string &stage, auto&&... args) {
+        benchmark::RegisterBenchmark((stage + suffix).c_str(), args...)->Unit(benchmark::kMicrosecond);
+    };
+    add("color", BM_ColorConvert, image);
+    add("color_scalar", BM_ColorConvertScalar, image);
+    add("sampling_444", BM_Sampling, image, YUVFormat::YUV444);
+    add("sampling_420", BM_Sampling, image, YUVFormat::YUV420);
+    add("sampling_422", BM_Sampling, image, YUVFormat::YUV422);
+    add("fdct", BM_FDCT, image);
+    add("fdct_scalar", BM_FDCTScalar, image);
+    add("quantize", BM_Quantize, image);
+    add("zigzag", BM_Zigzag, image);
+    add("huffman_blocks", BM_HuffmanBlocks, image);
+    add("huffman_optimize", BM_HuffmanOptimize, image);
+    add("progressive", BM_Progressive, image);
+    add("encode_420", BM_Encode, image, YUVFormat::YUV420);
+}
+
+}
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv); // leaves the arguments it does not know
+    benchmark::RegisterBenchmark("bitwriter", BM_BitWriter);
+    benchmark::RegisterBenchmark("header", BM_Header);
+    for (int size : {64, 512, 2048}) {
+        registerStages(syntheticImage(size, size));
+    }
+    for (int i = 1; i < argc; ++i) {
+        try {
+            registerStages(fileImage(argv[i]));
+        } catch (const std::exception &ex) {
+            fprintf(stderr, "skipping %s: %s\n", argv[i], ex.what());
+        }
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -1,14 +1,15 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <vector>
+#include <sys/uio.h>
 
 #include "JpegColor.hpp"
+#include "JpegBitWriter.hpp"
+#include "JpegChunkBuffer.hpp"
 
-typedef struct {
-    unsigned runlen: 4;
-    unsigned codesize: 4;
-    unsigned codedata: 16;
-} RLEITEM;
+class JpegThreadPool;
 
 typedef struct {
     int symbol; 
@@ -23,18 +24,107 @@ public:
     HuffmanCodec();
     ~HuffmanCodec();
 
-    long encode(const int* yBlocks, const int* uBlocks, const int* vBlocks,
+    /// entropy-code the whole image, returns the scan length (-1 on failure); the
+    /// output grows in chunks as needed, its memory is kept for the next encode
+    long encode(const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
                 const int w, const int h, YUVFormat format);
 
+    /// encode() straight into the caller's buffer of capacity bytes, on the calling thread;
+    /// returns the scan length, -1 if it did not fit (maxScanBytes always fits). The
+    /// result accessors below are empty afterwards
+    long encodeInto(uint8_t* dst, const size_t capacity,
+                    const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                    const int w, const int h, YUVFormat format);
+
+    /// the scan as one contiguous buffer, chunked output of encode() is joined on demand
     char* getResult();
+    /// bytes of the scan of encode(), the valid length of getResult()
+    size_t resultSize() const;
+    /// the scan of encode() as (data, size) pieces in output order, valid until the next encode
+    const std::vector<struct iovec>& resultChunks() const { return mResult; }
+
+    /// blocks encode() reads for an image of w x h: lumaBlocks of the Y plane (MCUs x
+    /// blocks per MCU) and chromaBlocks (one per MCU) of each of U and V
+    static void blockCounts(const int w, const int h, YUVFormat format, size_t &lumaBlocks, size_t &chromaBlocks);
+    /// worst-case scan length of an image, stuffing and restart markers included
+    static size_t maxScanBytes(const int w, const int h, YUVFormat format, const int restartRows = 0);
+
+    /// incremental interface, used by the streaming encoder:
+    /// beginScan resets the DC predictors and makes room for capacity bytes,
+    /// encodeMcus appends mcus MCUs and returns the bytes buffered so far,
+    /// rewind restarts the buffer once the caller consumed those bytes,
+    /// finishScan pads the last byte and returns the final buffered length
+    void beginScan(const size_t capacity);
+    long encodeMcus(const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                    const size_t mcus, YUVFormat format);
+    void rewind();
+    long finishScan();
+    /// end the current restart interval: pad the last byte, write RSTn (n = index % 8)
+    /// and reset the DC predictors
+    void writeRestart(const int index);
+
+    /// restart interval in MCU rows, 0 disables restart markers; with restarts encode()
+    /// codes the intervals in parallel on up to `threads` threads (0: all cores), the
+    /// output does not depend on the thread count. The calling thread takes part, the
+    /// others are started on first use and kept for the next encodes
+    void setRestartInterval(const int mcuRows, const int threads = 1);
+    /// DRI value in MCUs for an image of width w, 0 if restarts are disabled
+    int restartIntervalMcus(const int w, YUVFormat format) const;
+
+    /// two-pass mode: gather the DC/AC symbol statistics of the blocks (same arguments
+    /// as encode, restart intervals included) and replace the tables with optimal
+    /// length-limited (16-bit) canonical codes for this image
+    void optimizeTables(const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                        const int w, const int h, YUVFormat format);
+    /// back to the standard tables of Annex K, free if they are still in use
+    void resetTables();
+    /// table in use, DHT layout: 16 code length counts followed by the symbols
+    const uint8_t* huffmanTable(bool dc, bool luminance) const;
+
+    /// optimal length-limited (16-bit) canonical code for the symbol frequencies, written
+    /// in DHT layout into hufTable (16 + 256 bytes); unused symbols get no code
+    static void buildOptimalTable(const long freq[256], uint8_t *hufTable);
+    /// the codes of a DHT layout table, packed (length << 16 | code) per symbol
+    static void buildCodes(const uint8_t *hufTable, uint32_t codes[256]);
+    /// magnitude category of a coefficient (or EOB run): the bit length of its absolute value
+    static int magnitudeCategory(const uint32_t magnitude) {
+#if defined(__GNUC__)
+        return magnitude ? 32 - __builtin_clz(magnitude) : 0;
+#else
+        int n = 0;
+        for (uint32_t x = magnitude; x; x >>= 1) ++n;
+        return n;
+#endif
+    }
+
+    /// upper bound of the entropy-coded bytes of one 8x8 block, including stuffing
+    static const size_t MAX_BLOCK_BYTES;
+    /// room the writer may use besides the coded blocks: pending accumulator bits and
+    /// the free space its word writes require
+    static const size_t WRITER_SLACK_BYTES = 32;
 private:
     void initCodeList(bool dc, bool luminance);
 
-    void encodeBlock(const int *const block, int &dc, bool luminance);
+    void countBlock(const int16_t *const block, int &dc, long *dcFreq, long *acFreq) const;
+
+    /// with chunks, the writer moves to a new chunk whenever less than the worst case
+    /// of one MCU is left; without, the buffer must hold all mcus
+    void encodeMcusTo(JpegBitWriter &writer, int dcCache[3],
+                      const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                      const size_t mcus, YUVFormat format,
+                      JpegChunkBuffer *chunks = nullptr) const;
+
+    /// code mcus MCUs from zero DC predictors into chunks, returns false on overflow
+    bool encodeToChunks(JpegChunkBuffer &chunks,
+                        const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                        const size_t mcus, YUVFormat format) const;
+
+    void encodeBlock(JpegBitWriter &writer, const int16_t *const block, int &dc,
+                     const uint32_t *dcCodes, const uint32_t *acCodes) const;
 
-    void categoryEncode(int &code, int &size);
+    static void categoryEncode(int &code, int &size);
 
-    bool huffmanEncode(HUFCODEITEM *codeList, int size);
+    static void huffmanEncode(JpegBitWriter &writer, const uint32_t *codes, int symbol, uint32_t extra, int extraSize);
 
 public:
     static const uint8_t STD_HUFTAB_LUMIN_AC[];
@@ -44,11 +134,25 @@ public:
 
 private:
     char *mBuffer;
-    void *mBitStream;
+    size_t mBufferSize;
+    JpegChunkBuffer mChunks;
+    std::vector<JpegChunkBuffer> mSegmentChunks; // one per restart interval
+    std::vector<struct iovec> mResult;
+    JpegBitWriter mWriter;
+    int mDcCache[3]; // cache for DPCM 
+    int mRestartRows;
+    int mThreads;
+    std::unique_ptr<JpegThreadPool> mPool; // mThreads - 1 helpers of the restart path
     HUFCODEITEM mCodeListDCLumin[256]; 
     HUFCODEITEM mCodeListDCChrom[256]; 
     HUFCODEITEM mCodeListACLumin[256]; 
     HUFCODEITEM mCodeListACChrom[256]; 
+    // DHT layout tables: DC luminance, DC chrominance, AC luminance, AC chrominance
+    uint8_t mHufTables[4][16 + 256];
+    bool mStandardTables; // mHufTables and the code lists hold the Annex K tables
+    // packed (length << 16 | code) per symbol for the encoder, [0] luminance, [1] chrominance
+    uint32_t mDCCodes[2][256];
+    uint32_t mACCodes[2][256];
 
-    const uint8_t MAX_HUFFMAN_CODE_LEN = 16;
+    static constexpr int MAX_HUFFMAN_CODE_LEN = 16;
 };
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "common.hpp"
+
+///
+/// bump allocator for the scratch of one encode: every encode starts with
+/// reserve(), which drops the previous allocations and sizes one block for the
+/// new ones, so repeated encodes of the same size run without calling malloc.
+/// Allocations beyond the reserved size are carved out of further blocks, which
+/// the next reserve() merges.
+///
+class JpegArena {
+public:
+    JpegArena(): mOffset(0) { }
+    ~JpegArena() { release(); }
+
+    JpegArena(const JpegArena&) = delete;
+    JpegArena& operator=(const JpegArena&) = delete;
+
+    /// uninitialized room for n objects of T, aligned to JPEG_SIMD_ALIGN; valid until the next reserve()
+    template <typename T>
+    T* allocate(const size_t n) {
+        const size_t bytes = alignUp(n * sizeof(T));
+        if (mBlocks.empty() || mOffset + bytes > mBlocks.back().capacity) {
+            addBlock(bytes);
+        }
+        uint8_t* p = mBlocks.back().data + mOffset;
+        mOffset += bytes;
+        return reinterpret_cast<T*>(p);
+    }
+
+    /// drop every allocation and make the next `bytes` of allocations fit one block.
+    /// The memory is kept for later encodes unless it exceeds SHRINK_FACTOR times
+    /// what this one needs, so one huge image does not pin its peak in an encoder
+    /// (e.g. a worker of a batch) that goes on with small ones
+    void reserve(const size_t bytes) {
+        const size_t total = capacity();
+        const bool shrink = total > SHRINK_FACTOR * (bytes > MIN_BLOCK_BYTES ? bytes : MIN_BLOCK_BYTES);
+        if (mBlocks.size() != 1 || total < bytes || shrink) {
+            release();
+            addBlock(shrink || total < bytes ? bytes : total);
+        }
+        mOffset = 0;
+    }
+
+    /// bytes allocated from the system
+    size_t capacity() const {
+        size_t total = 0;
+        for (const Block &block : mBlocks) total += block.capacity;
+        return total;
+    }
+
+    /// room one array of n objects of T takes, for sizing reserve()
+    template <typename T>
+    static size_t footprint(const size_t n) { return alignUp(n * sizeof(T)); }
+
+    static const size_t MIN_BLOCK_BYTES = size_t(64) << 10;
+    static const size_t SHRINK_FACTOR = 4;
+
+private:
+    static size_t alignUp(const size_t bytes) {
+        return (bytes + JPEG_SIMD_ALIGN - 1) / JPEG_SIMD_ALIGN * JPEG_SIMD_ALIGN;
+    }
+
+    void addBlock(const size_t minBytes) {
+        // grow geometrically so an unsized arena settles after a few encodes
+        size_t bytes = mBlocks.empty() ? MIN_BLOCK_BYTES : mBlocks.back().capacity * 2;
+        if (bytes < minBytes) bytes = minBytes;
+        void* p = nullptr;
+        if (posix_memalign(&p, JPEG_SIMD_ALIGN, bytes) != 0) throw std::bad_alloc();
+        mBlocks.push_back(Block{static_cast<uint8_t*>(p), bytes});
+        mOffset = 0;
+    }
+
+    void release() {
+        for (const Block &block : mBlocks) free(block.data);
+        mBlocks.clear();
+        mOffset = 0;
+    }
+
+    struct Block {
+        uint8_t* data;
+        size_t capacity;
+    };
+    std::vector<Block> mBlocks;
+    size_t mOffset; // bytes used in the last block
+};
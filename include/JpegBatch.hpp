@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "JpegColor.hpp"
+
+/// one image of a batch
+struct JpegJob {
+    std::string input;
+    std::string output;
+    int quality;
+    YUVFormat format;
+};
+
+/// aggregate result of a batch
+struct JpegBatchStats {
+    size_t images;        // encoded successfully
+    size_t failed;
+    uint64_t pixels;      // input pixels of the encoded images
+    uint64_t outputBytes; // JPEG bytes written
+    double seconds;       // wall time of the whole batch
+};
+
+///
+/// encodes many images in one process: the jobs are spread over a work-stealing
+/// thread pool and every worker keeps its own encoder, so buffers are reused
+/// from one image to the next
+///
+class JpegBatch {
+public:
+    /// threads <= 0: one worker per hardware thread
+    explicit JpegBatch(const int threads = 0);
+
+    /// encoder settings of every job
+    void setRestartInterval(const int mcuRows) { mRestartRows = mcuRows; }
+    void setOptimizeHuffman(const bool optimize) { mOptimizeHuffman = optimize; }
+    /// progressive output with the default scan script
+    void setProgressive(const bool progressive) { mProgressive = progressive; }
+    /// run the jobs through the staged pipeline instead of one task per image; progressive
+    /// batches always run as tasks, their scans need the whole coefficient planes at once
+    void setPipeline(const bool pipeline) { mPipeline = pipeline; }
+
+    /// decode, encode and write every job; failures are reported on stderr and counted
+    JpegBatchStats run(const std::vector<JpegJob> &jobs);
+
+    /// one job per input, written to outputDir as <name>.jpg
+    static std::vector<JpegJob> fromInputs(const std::vector<std::string> &inputs,
+                                           const std::string &outputDir,
+                                           const int quality, YUVFormat format);
+
+    /// every image file of a directory (by extension, sorted by name)
+    static std::vector<JpegJob> fromDirectory(const std::string &dir,
+                                              const std::string &outputDir,
+                                              const int quality, YUVFormat format);
+
+    /// manifest file, one job per line: input [output [quality [format]]]
+    /// a missing field or "-" takes the default, '#' starts a comment; a plain
+    /// list of input files is a valid manifest
+    static std::vector<JpegJob> fromManifest(const std::string &path,
+                                             const std::string &outputDir,
+                                             const int quality, YUVFormat format);
+
+    /// "444", "420" or "422"
+    static YUVFormat parseFormat(const std::string &format);
+
+private:
+    /// one pool task per image, each runs all stages of its image
+    JpegBatchStats runTasks(const std::vector<JpegJob> &jobs);
+
+    ///
+    /// decode -> transform (color, DCT, quantization) -> entropy coding -> write,
+    /// every stage on its own threads and linked by bounded queues, so decoding
+    /// image N+1 overlaps encoding N and writing N-1; full queues block the stage
+    /// in front of them, which caps the images in flight
+    ///
+    JpegBatchStats runPipeline(const std::vector<JpegJob> &jobs);
+
+    static std::string defaultOutput(const std::string &input, const std::string &outputDir);
+
+private:
+    int mThreads;
+    int mRestartRows;
+    bool mOptimizeHuffman;
+    bool mProgressive;
+    bool mPipeline;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+///
+/// entropy-coded segment writer: bits are collected MSB first in a 64-bit
+/// accumulator and written out a whole word at a time. JPEG byte stuffing
+/// (0xFF -> 0xFF 0x00) only takes the slow byte-by-byte path for words that
+/// actually contain a 0xFF byte.
+///
+class JpegBitWriter {
+public:
+    JpegBitWriter() { reset(nullptr, 0); }
+    JpegBitWriter(uint8_t* buffer, const size_t capacity) { reset(buffer, capacity); }
+
+    /// restart writing at the beginning of buffer
+    void reset(uint8_t* buffer, const size_t capacity) {
+        mBegin = mPos = buffer;
+        mEnd = buffer + capacity;
+        mAcc = 0;
+        mFree = 64;
+        mOverflow = false;
+    }
+
+    /// continue at the beginning of the buffer, pending bits are kept; used once the
+    /// caller has consumed the first size() bytes
+    void rewind() {
+        mPos = mBegin;
+    }
+
+    /// continue in another buffer, pending bits are kept; size() then counts from buffer
+    void setBuffer(uint8_t* buffer, const size_t capacity) {
+        mBegin = mPos = buffer;
+        mEnd = buffer + capacity;
+    }
+
+    /// append the low n bits of bits, n <= 32 and the bits above n must be zero
+    inline void putBits(const uint32_t bits, const int n) {
+        if (n < mFree) {
+            mAcc = (mAcc << n) | bits;
+            mFree -= n;
+            return;
+        }
+        const int rest = n - mFree;
+        emitWord((mAcc << mFree) | (uint64_t(bits) >> rest));
+        mAcc = bits & ((uint64_t(1) << rest) - 1);
+        mFree = 64 - rest;
+    }
+
+    /// pad the last byte with 1-bits and write out everything buffered, returns the size
+    size_t flush() {
+        const int used = 64 - mFree;
+        if (used % 8) {
+            const int pad = 8 - used % 8;
+            putBits((1u << pad) - 1, pad);
+        }
+        for (int n = 64 - mFree; n > 0; n -= 8) {
+            putByte(static_cast<uint8_t>(mAcc >> (n - 8)));
+        }
+        mAcc = 0;
+        mFree = 64;
+        return size();
+    }
+
+    /// write a marker (0xFF, code) as is, the writer must be flushed to a byte boundary
+    void putMarker(const uint8_t code) {
+        if (static_cast<size_t>(mEnd - mPos) < 2) {
+            mOverflow = true;
+            return;
+        }
+        *mPos++ = 0xFF;
+        *mPos++ = code;
+    }
+
+    size_t size() const { return mPos - mBegin; }
+    /// room left in the buffer
+    size_t available() const { return mEnd - mPos; }
+    /// true if the buffer was too small, the output is then truncated
+    bool overflow() const { return mOverflow; }
+
+private:
+    static const size_t MAX_WORD_BYTES = 16; // 8 bytes, each possibly stuffed
+
+    inline void emitWord(const uint64_t word) {
+        if (static_cast<size_t>(mEnd - mPos) < MAX_WORD_BYTES) {
+            mOverflow = true;
+            return;
+        }
+        if ((word & 0x8080808080808080ull & ~(word + 0x0101010101010101ull)) == 0) {
+            // no 0xFF byte in this word
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            const uint64_t be = __builtin_bswap64(word);
+            std::memcpy(mPos, &be, 8);
+            mPos += 8;
+#else
+            for (int i = 56; i >= 0; i -= 8) *mPos++ = static_cast<uint8_t>(word >> i);
+#endif
+            return;
+        }
+        for (int i = 56; i >= 0; i -= 8) {
+            const uint8_t c = static_cast<uint8_t>(word >> i);
+            *mPos++ = c;
+            if (c == 0xFF) *mPos++ = 0x00;
+        }
+    }
+
+    inline void putByte(const uint8_t c) {
+        if (static_cast<size_t>(mEnd - mPos) < 2) {
+            mOverflow = true;
+            return;
+        }
+        *mPos++ = c;
+        if (c == 0xFF) *mPos++ = 0x00;
+    }
+
+private:
+    uint8_t* mBegin;
+    uint8_t* mPos;
+    uint8_t* mEnd;
+    uint64_t mAcc;  // pending bits, right-aligned
+    int mFree;      // free bits in mAcc, in [1, 64]
+    bool mOverflow;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+///
+/// growable output for entropy-coded data: a list of chunks with geometrically
+/// growing capacity. Growing never moves bytes already written, and clear()
+/// keeps the chunks so the next scan writes into the same memory.
+///
+class JpegChunkBuffer {
+public:
+    static const size_t FIRST_CHUNK_BYTES = 16 << 10;
+    static const size_t MAX_CHUNK_BYTES = 4 << 20;
+
+    JpegChunkBuffer(): mUsed(0) { }
+
+    /// forget the content, allocated chunks are reused
+    void clear() { mUsed = 0; }
+
+    /// close the current chunk (if any) at `used` bytes and start the next one with at
+    /// least minFree bytes; returns the chunk and its capacity
+    uint8_t* nextChunk(const size_t used, const size_t minFree, size_t &capacity) {
+        if (mUsed > 0) {
+            mChunks[mUsed - 1].size = used;
+        }
+        if (mUsed < mChunks.size() && mChunks[mUsed].capacity < minFree) {
+            mChunks.resize(mUsed); // too small for this request, reallocate from here
+        }
+        if (mUsed == mChunks.size()) {
+            size_t bytes = mUsed == 0 ? FIRST_CHUNK_BYTES
+                                      : std::min<size_t>(mChunks[mUsed - 1].capacity * 2, size_t(MAX_CHUNK_BYTES));
+            bytes = std::max(bytes, minFree);
+            mChunks.push_back(Chunk{std::unique_ptr<uint8_t[]>(new uint8_t[bytes]), bytes, 0});
+        }
+        Chunk &chunk = mChunks[mUsed++];
+        chunk.size = 0;
+        capacity = chunk.capacity;
+        return chunk.data.get();
+    }
+
+    /// close the current chunk at `used` bytes
+    void finish(const size_t used) {
+        if (mUsed > 0) {
+            mChunks[mUsed - 1].size = used;
+        }
+    }
+
+    size_t chunkCount() const { return mUsed; }
+    const uint8_t* chunkData(const size_t i) const { return mChunks[i].data.get(); }
+    size_t chunkSize(const size_t i) const { return mChunks[i].size; }
+
+    /// bytes written over all chunks
+    size_t size() const {
+        size_t total = 0;
+        for (size_t i = 0; i < mUsed; ++i) total += mChunks[i].size;
+        return total;
+    }
+
+    /// allocated bytes, written or not
+    size_t capacity() const {
+        size_t total = 0;
+        for (auto &chunk : mChunks) total += chunk.capacity;
+        return total;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<uint8_t[]> data;
+        size_t capacity;
+        size_t size;
+    };
+    std::vector<Chunk> mChunks;
+    size_t mUsed; // chunks holding data of the current scan
+};
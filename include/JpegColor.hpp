@@ -13,15 +13,41 @@ public:
    JpegColor()=default;
    ~JpegColor()=default;
 
-   static Image<uint8_t> rgbToYUV444(const Image<uint8_t> &rgb);
-
-   static void sampleToBlocks(const Image<uint8_t> &img, 
-                        std::vector<uint8_t> &y_blocks, 
-                        std::vector<uint8_t> &u_blocks, 
-                        std::vector<uint8_t> &v_blocks, 
-                        const int block_w, const int block_h,
-                        const int sx, const int sy 
-                        );
+   static Image<uint8_t> rgbToYUV444(const ImageView<uint8_t> &rgb);
+
+   /// convert n interleaved RGB pixels into planar Y, Cb, Cr rows (AVX2 when available)
+   static void rgbRowToYCbCr(const uint8_t* rgb, uint8_t* y, uint8_t* cb, uint8_t* cr, const int n);
+   /// portable reference of rgbRowToYCbCr, the SIMD path is bit-exact with it
+   static void rgbRowToYCbCrScalar(const uint8_t* rgb, uint8_t* y, uint8_t* cb, uint8_t* cr, const int n);
+
+   /// fused RGB -> YCbCr, chroma subsampling and 8x8 block extraction: every block_w x block_h
+   /// macroblock, left to right and top to bottom, gives sx * sy consecutive Y blocks (in the
+   /// same order) and one U and one V block; the edges repeat the last row and column
+   static void rgbToBlocks(const ImageView<uint8_t> &rgb,
+                           std::vector<uint8_t> &y_blocks,
+                           std::vector<uint8_t> &u_blocks,
+                           std::vector<uint8_t> &v_blocks,
+                           const int block_w, const int block_h,
+                           const int sx, const int sy);
+
+   /// rgbToBlocks into caller-owned planes of blockCount(...) blocks each, with a
+   /// reusable row scratch buffer
+   static void rgbToBlocks(const ImageView<uint8_t> &rgb,
+                           uint8_t* y_blocks, uint8_t* u_blocks, uint8_t* v_blocks,
+                           const int block_w, const int block_h,
+                           const int sx, const int sy,
+                           std::vector<uint8_t> &scratch);
+
+   /// number of 8x8 chroma blocks of an image (the Y plane has sx * sy times as many)
+   static size_t blockCount(const int w, const int h, const int block_w, const int block_h);
+
+   /// fused stage for the macroblock row mb_row only, writes block_nw * sx * sy Y blocks
+   /// and block_nw U/V blocks; scratch is resized on demand and can be reused across rows
+   static void mcuRowToBlocks(const ImageView<uint8_t> &rgb, const int mb_row,
+                              uint8_t* y_blocks, uint8_t* u_blocks, uint8_t* v_blocks,
+                              const int block_w, const int block_h,
+                              const int sx, const int sy,
+                              std::vector<uint8_t> &scratch);
 }; // end of class
 
 
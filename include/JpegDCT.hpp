@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+///
+/// forward DCT on 8x8 blocks, integer separable (LLM) algorithm with the accuracy
+/// of libjpeg's "islow" method, samples are level-shifted by -128 internally and
+/// the output is the true-scale 2-D DCT rounded to integers; for 8-bit samples
+/// every coefficient lies in [-1024, 1024], so it is stored as int16_t
+///
+class JpegDCT {
+public:
+    JpegDCT()=default;
+    ~JpegDCT()=default;
+
+    /// transform nblocks consecutive 8x8 blocks, 8 blocks at a time with AVX2 when available
+    static void fdctBlocks(const uint8_t* blocks, int16_t* dct, const size_t nblocks);
+
+    /// portable reference for a single block, the SIMD path is bit-exact with it
+    static void fdct8x8Scalar(const uint8_t* block, int16_t* dct);
+};
@@ -1,35 +1,179 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <cstdint>
+#include <memory>
 #include "JpegQuant.hpp"
 #include "JpegColor.hpp"
 #include "image.hpp"
+#include "JpegSink.hpp"
+#include "common.hpp"
+#include "JpegArena.hpp"
+#include "JpegProgressive.hpp"
 
+class HuffmanCodec;
+
+/// quantized coefficients of one image in zigzag order, the input of entropy coding
+struct JpegCoefficients {
+    int width;
+    int height;
+    YUVFormat format;
+    std::shared_ptr<JpegQuant> quantizer;
+    AlignedVector<int16_t> y, u, v;
+};
+
+///
+/// an encoder is a long-lived context: the quantizer, the entropy coder with its
+/// code tables and output chunks, the coefficient planes and an arena for the
+/// pixel scratch are kept from one encode to the next, the tables are rebuilt
+/// only when the quality or the table mode changes. One context per thread.
+/// Input pixels are taken as an ImageView, an Image or any strided RGB buffer.
+///
 class JpegEncoder {
 public:
-    JpegEncoder(std::string outputPath): mOutputPath(outputPath) { };
+    JpegEncoder(std::string outputPath = ""): mOutputPath(outputPath), mRestartRows(0), mThreads(1), mOptimizeHuffman(false),
+                                              mProgressive(false), mVerbose(true) { };
     ~JpegEncoder()=default;
 
-    void encodeRGB(const Image<uint8_t> &rgb_img,
+    void encodeRGB(const ImageView<uint8_t> &rgb_img,
                    const int quality, 
                    YUVFormat format, 
                    const bool force_baseline=true 
                    );
 
+    /// encodeRGB into any output sink (file descriptor, memory, callback)
+    void encodeRGB(const ImageView<uint8_t> &rgb_img,
+                   const int quality,
+                   YUVFormat format,
+                   JpegSink &sink,
+                   const bool force_baseline=true
+                   );
+
+    /// encode into memory, the returned buffer holds the complete JPEG file
+    std::vector<uint8_t> encodeToBuffer(const ImageView<uint8_t> &rgb_img,
+                                        const int quality,
+                                        YUVFormat format,
+                                        const bool force_baseline=true
+                                        );
+
+    /// encode into the caller's buffer of dst_capacity bytes, returns the file size
+    /// or -1 if the buffer is too small; with at least maxEncodedSize bytes the scan
+    /// is coded in place (unless restart intervals are coded on several threads)
+    long encodeToBuffer(const ImageView<uint8_t> &rgb_img,
+                        const int quality,
+                        YUVFormat format,
+                        uint8_t* dst, const size_t dst_capacity,
+                        const bool force_baseline=true
+                        );
+
+    /// the stages of encodeRGB, for callers that run them on different threads:
+    /// color conversion, DCT and quantization
+    void transformRGB(const ImageView<uint8_t> &rgb_img,
+                      const int quality,
+                      YUVFormat format,
+                      JpegCoefficients &coefficients,
+                      const bool force_baseline=true
+                      );
+    /// entropy coding with the restart and table settings of this encoder, the scan
+    /// is left in huffmanCodec; returns its length (<= 0 on failure)
+    long entropyCode(const JpegCoefficients &coefficients, HuffmanCodec &huffmanCodec);
+    /// header, scan and trailer into the sink, throws on write errors
+    static void writeJpeg(const JpegCoefficients &coefficients, const HuffmanCodec &huffmanCodec,
+                          JpegSink &sink);
+
+    /// worst-case file size, a buffer of this size always fits encodeToBuffer (sequential
+    /// output; progressive output is usually smaller, encodeToBuffer checks it)
+    static size_t maxEncodedSize(const int w, const int h, YUVFormat format, const int restartRows = 0);
+
+    /// insert a restart marker every mcuRows rows of MCUs (0: none); the restart
+    /// intervals are entropy-coded in parallel on `threads` threads (0: all cores)
+    void setRestartInterval(const int mcuRows, const int threads = 1) {
+        mRestartRows = mcuRows;
+        mThreads = threads;
+    }
+
+    /// two-pass entropy coding with Huffman tables optimized for each image (full mode only)
+    void setOptimizeHuffman(const bool optimize) {
+        mOptimizeHuffman = optimize;
+    }
+
+    /// progressive (SOF2) output in the scans of script, each scan with its own optimized
+    /// Huffman tables; an empty script takes JpegProgressive::defaultScript(). Full mode
+    /// and encodeToBuffer only, without restart markers; throws on an invalid script
+    void setProgressive(const bool progressive, const std::vector<JpegScan> &script = {}) {
+        if (progressive && !script.empty()) {
+            JpegProgressive::validateScript(script);
+        }
+        mProgressive = progressive;
+        mScript = script.empty() ? JpegProgressive::defaultScript() : script;
+    }
+
+    /// print the coded length and compression ratio of every image (default on)
+    void setVerbose(const bool verbose) {
+        mVerbose = verbose;
+    }
+
+    /// same output as encodeRGB, but processed one MCU row at a time with memory bounded by the width
+    void encodeRGBStreaming(const ImageView<uint8_t> &rgb_img,
+                            const int quality,
+                            YUVFormat format,
+                            const bool force_baseline=true
+                            );
+
+    /// encodeRGBStreaming into any output sink, one write per MCU row
+    void encodeRGBStreaming(const ImageView<uint8_t> &rgb_img,
+                            const int quality,
+                            YUVFormat format,
+                            JpegSink &sink,
+                            const bool force_baseline=true
+                            );
+
 private:
+    static void samplingFactors(YUVFormat format, int &block_w, int &block_h, int &sx, int &sy);
 
-    std::vector<int> blocksToFDCT(const std::vector<uint8_t> &blocks, 
-                                  const int block_stride);
+    /// entropy coder kept across encodes, so its output chunks are allocated once
+    std::shared_ptr<HuffmanCodec> reusableCodec();
+    /// quantizer of the previous encode if the settings match, else a new one (a
+    /// quantizer may still be referenced by coefficients handed out earlier)
+    std::shared_ptr<JpegQuant> reusableQuantizer(const int quality, const bool force_baseline);
 
-    void fdctToQuant(JpegQuant* quantizer,
-                     std::vector<int> &dct,  
-                     const int block_stride, 
+    /// restart interval and the Huffman tables of entropyCode (optimized or standard)
+    void prepareCodec(const JpegCoefficients &coefficients, HuffmanCodec &huffmanCodec);
+
+    /// transformRGB and entropyCode, throws if entropy coding fails
+    long encodeScan(const ImageView<uint8_t> &rgb_img, const int quality, YUVFormat format,
+                    const bool force_baseline, JpegCoefficients &coefficients,
+                    HuffmanCodec &huffmanCodec);
+
+    /// transformRGB and the scans of the progressive script into mProgressiveCoder,
+    /// returns the length of its result
+    long encodeProgressive(const ImageView<uint8_t> &rgb_img, const int quality, YUVFormat format,
+                           const bool force_baseline);
+
+    /// DCT of nblocks 8x8 blocks into dct, which is resized to fit
+    void blocksToFDCT(const uint8_t* blocks, const size_t nblocks,
+                      AlignedVector<int16_t> &dct);
+
+    /// quantization and zigzag reordering in one pass, in place
+    void fdctToQuant(const JpegQuant* quantizer,
+                     int16_t* dct,
+                     const size_t nblocks,
                      const bool luminance
                      );
 
-    void quantToZigzag(std::vector<int> &quant, const int block_stride);
-
 private:
     std::string mOutputPath;
-     
+    int mRestartRows;
+    int mThreads;
+    bool mOptimizeHuffman;
+    bool mProgressive;
+    std::vector<JpegScan> mScript;
+    bool mVerbose;
+    std::shared_ptr<HuffmanCodec> mHuffmanCodec;
+    std::shared_ptr<JpegProgressive> mProgressiveCoder;
+    std::shared_ptr<JpegQuant> mQuantizer;
+    JpegCoefficients mCoefficients; // planes of encodeRGB / encodeToBuffer
+    JpegArena mArena;               // pixel blocks of the current encode
+    std::vector<uint8_t> mRowScratch;
 };
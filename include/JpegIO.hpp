@@ -2,8 +2,10 @@
 
 #include <cstdint>
 #include <cassert>
+#include <cstddef>
 
 #include "JpegColor.hpp"
+#include "JpegSink.hpp"
 
 class JpegIO {
 public:
@@ -11,6 +13,7 @@ public:
   ~JpegIO()=default;
 
 public:
+   /// write a complete JPEG file, returns false on failure
    static bool writeToFile(const char* dst_file, /* destination file, e.g., 001.jpg */
                     const char* buffer,   /* encoded image data */
                     long dataLength,
@@ -18,5 +21,77 @@ public:
                     const uint8_t* huf_ac_tab[2], /* huffman coding table: AC */
                     const uint8_t* huf_dc_tab[2], /* huffman coding table: DC */
                     const int w, const int h,
+                    YUVFormat format,
+                    const int restart_interval = 0 /* DRI in MCUs, 0: no restart markers */);
+
+   /// header, scan data and trailer in a single sink write, false on failure (see sink.error())
+   static bool writeJpeg(JpegSink& sink,
+                    const char* buffer,
+                    long dataLength,
+                    const int* quant_tab[2],
+                    const uint8_t* huf_ac_tab[2],
+                    const uint8_t* huf_dc_tab[2],
+                    const int w, const int h,
+                    YUVFormat format,
+                    const int restart_interval = 0);
+
+   /// writeJpeg for a scan held in scanCount pieces, e.g. HuffmanCodec::resultChunks()
+   static bool writeJpeg(JpegSink& sink,
+                    const struct iovec* scan,
+                    const int scanCount,
+                    const int* quant_tab[2],
+                    const uint8_t* huf_ac_tab[2],
+                    const uint8_t* huf_dc_tab[2],
+                    const int w, const int h,
+                    YUVFormat format,
+                    const int restart_interval = 0);
+
+   /// bytes written by writeHeader for these Huffman tables
+   static size_t headerSize(const uint8_t* huf_ac_tab[2],
+                    const uint8_t* huf_dc_tab[2],
+                    const int restart_interval = 0);
+
+   /// serialize the header into dst (at least headerSize bytes), returns the bytes written
+   static size_t writeHeader(uint8_t* dst,
+                    const int* quant_tab[2],
+                    const uint8_t* huf_ac_tab[2],
+                    const uint8_t* huf_dc_tab[2],
+                    const int w, const int h,
+                    YUVFormat format,
+                    const int restart_interval = 0);
+
+   /// SOI, DQT and the frame header (SOF0, SOF2 if progressive) into dst, at least
+   /// FRAME_HEADER_SIZE bytes; returns the bytes written
+   static size_t writeFrameHeader(uint8_t* dst,
+                    const int* quant_tab[2],
+                    const int w, const int h,
+                    YUVFormat format,
+                    const bool progressive = false);
+
+   /// one DHT segment, table class DC or AC with id 0 (luminance) or 1 (chrominance),
+   /// at most MAX_DHT_SIZE bytes
+   static size_t writeHuffmanTable(uint8_t* dst, const uint8_t* huf_tab, const bool dc, const int id);
+
+   /// SOS of a scan over count components (0: Y, 1: Cb, 2: Cr), at most MAX_SOS_SIZE bytes
+   static size_t writeScanHeader(uint8_t* dst, const int* components, const int count,
+                    const int Ss, const int Se, const int Ah, const int Al);
+
+   /// frame header, the scans of JpegProgressive::result() and EOI in one sink write
+   static bool writeProgressiveJpeg(JpegSink& sink,
+                    const uint8_t* scans,
+                    const size_t length,
+                    const int* quant_tab[2],
+                    const int w, const int h,
                     YUVFormat format);
+
+   /// EOI into dst, returns the bytes written
+   static size_t writeTrailer(uint8_t* dst);
+
+   static const size_t TRAILER_SIZE = 2;
+   static const size_t FRAME_HEADER_SIZE = 2 + 2 * (4 + 1 + 64) + (4 + 6 + 3 * 3);
+   static const size_t MAX_DHT_SIZE = 4 + 1 + 16 + 256;
+   static const size_t MAX_SOS_SIZE = 4 + 1 + 2 * 3 + 3;
+
+   /// upper bound of headerSize: DHT tables with all 256 symbols
+   static const size_t MAX_HEADER_SIZE = FRAME_HEADER_SIZE + 4 * MAX_DHT_SIZE + 6 + MAX_SOS_SIZE;
 };
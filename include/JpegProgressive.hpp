@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "JpegColor.hpp"
+
+/// one scan of a progressive script (Annex G): a band of coefficients of one or
+/// more components, coded at bit position Al, refining Ah (0: first visit)
+struct JpegScan {
+    int componentCount;  // 1..3, several components only for DC scans
+    int components[3];   // 0: Y, 1: Cb, 2: Cr
+    int Ss, Se;          // spectral selection, zigzag indices 0..63
+    int Ah, Al;          // successive approximation bit positions
+};
+
+///
+/// progressive (SOF2) entropy coder: the quantized coefficients of an image are
+/// sent in the scans of a script, each scan with Huffman tables optimized for it.
+/// Every scan is coded in two passes over the blocks, the first one gathers the
+/// symbol statistics, the second one writes. The output holds the tables, the
+/// scan header and the data of every scan, to be framed by SOF2 and EOI.
+///
+class JpegProgressive {
+public:
+    JpegProgressive() = default;
+
+    /// the scan script of libjpeg's simple progression: DC first, then the low
+    /// luminance band, chrominance and the rest of luminance at reduced precision,
+    /// then the refinement scans
+    static std::vector<JpegScan> defaultScript();
+
+    /// throws std::runtime_error unless the script codes every coefficient of the
+    /// three components exactly once per bit, in an order a decoder accepts
+    static void validateScript(const std::vector<JpegScan> &script);
+
+    /// code the zigzag-ordered blocks of encodeMcus' layout, returns the length of result()
+    long encode(const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                const int w, const int h, YUVFormat format,
+                const std::vector<JpegScan> &script);
+
+    /// DHT, SOS and entropy-coded data of every scan of the last encode
+    const std::vector<uint8_t>& result() const { return mOutput; }
+
+    static const int MAX_AL = 10; // successive approximation limit of 8-bit data, as libjpeg
+
+private:
+    /// call visit(component, block) for every block of the scan, in coding order
+    template <typename Visit>
+    void codeScan(const Visit &visit, const JpegScan &scan) const;
+
+    struct Layout {
+        const int16_t* planes[3];
+        int blocksWide[3];   // blocks of the component rows in a non-interleaved scan
+        int blocksHigh[3];
+        int mcuWide;         // MCUs per row
+        size_t mcus;
+        int sx, sy;          // luminance blocks per MCU
+    };
+    Layout mLayout;
+    std::vector<uint8_t> mOutput;
+};
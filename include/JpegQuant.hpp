@@ -1,13 +1,20 @@
 #pragma once
 
 #include <vector>
+#include <cstdint>
+#include <cstddef>
 
 class JpegQuant {
 public:
     JpegQuant(const int quality, const bool force_baseline);
     ~JpegQuant();
 
-    void quantEncode8x8(int* data8x8, const bool luminance);
+    /// quantize a natural-order 8x8 block of DCT coefficients with rounding and write
+    /// the result in zigzag order, zz8x8 may alias dct8x8; coefficients are those of
+    /// 8-bit samples (|coef| <= 1024)
+    void quantZigzag8x8(const int16_t* dct8x8, int16_t* zz8x8, const bool luminance) const;
+    /// quantZigzag8x8 over nblocks consecutive blocks (AVX2 when available)
+    void quantZigzagBlocks(const int16_t* dct, int16_t* zz, const size_t nblocks, const bool luminance) const;
     void setQuality(int quality, const bool force_baseline);
 
 public:
@@ -18,6 +25,17 @@ public:
 
 private:
     std::vector<int> scaledQuality(int quality, const bool luminance, const bool force_baseline);
-};
+    void initReciprocals();
+    void initReciprocals16();
 
+    // division by the quantizer as (|x| + round) * recip >> shift, tables are in zigzag order,
+    // [0] luminance, [1] chrominance
+    uint32_t mRecip[2][64];
+    uint32_t mRound[2][64];
+    uint32_t mShift[2][64];
 
+    // the same division on 16-bit lanes, also in zigzag order: ((8|x| + corr) * recip >> 16) * scale >> 16
+    uint16_t mRecip16[2][64];
+    uint16_t mCorr16[2][64];
+    uint16_t mScale16[2][64];
+};
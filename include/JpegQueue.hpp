@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+///
+/// blocking FIFO with a fixed capacity, the link between two pipeline stages:
+/// push waits while the queue is full, which throttles a fast producer to the
+/// pace of its consumer and caps the memory held in flight
+///
+template <typename T>
+class JpegQueue {
+public:
+    explicit JpegQueue(const size_t capacity): mCapacity(capacity > 0 ? capacity : 1), mClosed(false) { }
+
+    JpegQueue(const JpegQueue&) = delete;
+    JpegQueue& operator=(const JpegQueue&) = delete;
+
+    /// wait for room and append item, false (item untouched) if the queue was closed
+    bool push(T &&item) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotFull.wait(lock, [this] { return mClosed || mItems.size() < mCapacity; });
+        if (mClosed) return false;
+        mItems.push_back(std::move(item));
+        mNotEmpty.notify_one();
+        return true;
+    }
+
+    /// wait for an item, false once the queue is closed and drained
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotEmpty.wait(lock, [this] { return mClosed || !mItems.empty(); });
+        if (mItems.empty()) return false;
+        item = std::move(mItems.front());
+        mItems.pop_front();
+        mNotFull.notify_one();
+        return true;
+    }
+
+    /// no more pushes; consumers still receive the queued items
+    void close() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClosed = true;
+        mNotEmpty.notify_all();
+        mNotFull.notify_all();
+    }
+
+    size_t capacity() const { return mCapacity; }
+
+private:
+    const size_t mCapacity;
+    bool mClosed;
+    std::deque<T> mItems;
+    std::mutex mMutex;
+    std::condition_variable mNotEmpty;
+    std::condition_variable mNotFull;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <functional>
+#include <sys/uio.h>
+
+///
+/// destination of the encoded bytes: the header, the scan and the trailer are
+/// handed over as one gather list, so a file descriptor gets a single writev
+///
+class JpegSink {
+public:
+    JpegSink()=default;
+    virtual ~JpegSink()=default;
+
+    /// write iovcnt buffers in order, false on failure (the reason is in error())
+    virtual bool write(const struct iovec* iov, int iovcnt) = 0;
+
+    bool write(const void* data, size_t size) {
+        struct iovec iov = {const_cast<void*>(data), size};
+        return write(&iov, 1);
+    }
+
+    const std::string& error() const { return mError; }
+
+protected:
+    std::string mError;
+};
+
+/// writes to a file descriptor, retrying partial writes; the path constructor
+/// creates the file and owns the descriptor
+class FdSink : public JpegSink {
+public:
+    explicit FdSink(int fd);
+    explicit FdSink(const char* path);
+    ~FdSink() override;
+
+    bool isOpen() const { return mFd >= 0; }
+    /// bytes written so far
+    size_t bytesWritten() const { return mBytes; }
+    /// close an owned descriptor, reports errors that were deferred by the file system
+    bool close();
+
+    bool write(const struct iovec* iov, int iovcnt) override;
+
+private:
+    int mFd;
+    bool mOwned;
+    size_t mBytes;
+};
+
+/// appends to a byte vector
+class MemorySink : public JpegSink {
+public:
+    MemorySink()=default;
+
+    bool write(const struct iovec* iov, int iovcnt) override;
+
+    std::vector<uint8_t>& data() { return mData; }
+    const std::vector<uint8_t>& data() const { return mData; }
+
+private:
+    std::vector<uint8_t> mData;
+};
+
+/// forwards every buffer to a callback, which returns false to abort
+class CallbackSink : public JpegSink {
+public:
+    typedef std::function<bool(const uint8_t* data, size_t size)> Callback;
+    explicit CallbackSink(Callback callback): mCallback(std::move(callback)) { }
+
+    bool write(const struct iovec* iov, int iovcnt) override;
+
+private:
+    Callback mCallback;
+};
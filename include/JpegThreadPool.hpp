@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///
+/// work-stealing thread pool: every worker owns a task deque, runs its own tasks
+/// newest first and, when it runs dry, steals the oldest task of another worker.
+/// Tasks receive the index of the worker that runs them, so callers can keep
+/// per-worker state (e.g. one encoder context per worker) without locking.
+///
+class JpegThreadPool {
+public:
+    typedef std::function<void(int worker)> Task;
+
+    /// threads <= 0: one worker per hardware thread
+    explicit JpegThreadPool(int threads = 0);
+    ~JpegThreadPool();
+
+    JpegThreadPool(const JpegThreadPool&) = delete;
+    JpegThreadPool& operator=(const JpegThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(mWorkers.size()); }
+
+    /// queue a task; from inside a task it goes to the calling worker's deque,
+    /// otherwise the deques are filled round robin
+    void submit(Task task);
+
+    /// block until every submitted task has finished, rethrows the first exception
+    /// a task threw
+    void wait();
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(const int index);
+    bool popLocal(const int index, Task &task);
+    bool steal(const int index, Task &task);
+
+private:
+    std::vector<std::unique_ptr<Queue>> mQueues;
+    std::vector<std::thread> mWorkers;
+
+    std::mutex mMutex;                  // guards sleeping and completion
+    std::condition_variable mWakeUp;    // tasks were queued or the pool stops
+    std::condition_variable mIdle;      // mPending dropped to zero
+    size_t mQueued;                     // tasks in the deques, guarded by mMutex
+    std::atomic<size_t> mPending;       // queued or running tasks
+    std::atomic<size_t> mNext;          // round robin cursor of external submits
+    bool mStop;
+    std::exception_ptr mError;
+};
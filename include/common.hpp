@@ -2,7 +2,10 @@
 
 
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
+#include <new>
+#include <vector>
 
 #define ASSERT(expr, message) \
 do { \
@@ -13,3 +16,49 @@ do { \
 } while (false)
 
 
+///
+/// SIMD kernels are compiled per function with the target attribute, so the
+/// rest of the project keeps the default ISA and the choice is made at runtime
+///
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define JPEG_X86_SIMD 1
+#define JPEG_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+inline bool cpuSupportsAVX2() {
+#ifdef JPEG_X86_SIMD
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+
+/// alignment of coefficient buffers, one AVX2 vector
+const size_t JPEG_SIMD_ALIGN = 32;
+
+/// allocator for buffers that SIMD kernels walk in whole vectors
+template <typename T, size_t Alignment = JPEG_SIMD_ALIGN>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) { }
+
+    T* allocate(size_t n) {
+        void* p = nullptr;
+        if (posix_memalign(&p, Alignment, n * sizeof(T) + (n == 0)) != 0) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { free(p); }
+};
+
+template <typename T, typename U, size_t A>
+bool operator==(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return true; }
+template <typename T, typename U, size_t A>
+bool operator!=(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return false; }
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
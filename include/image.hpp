@@ -14,6 +14,7 @@
 #include <utility>
 #include <algorithm>
 #include <cstring>
+#include <stdexcept>
 
 
 #ifdef __cplusplus
@@ -25,11 +26,69 @@ extern uint8_t* read_stb_rgb(const char* file, int &width, int &height, int &cha
 }
 #endif
 
+///
+/// bounds checking of the element accessors (operator(), operator[], get_pixel):
+/// CheckedAccess throws std::out_of_range, UncheckedAccess costs nothing. The
+/// default follows the build type, checked unless NDEBUG, and JPEG_IMAGE_CHECKS
+/// overrides it. at() is always checked; row pointers and row iterators never
+/// are, they are the access path of the kernels.
+///
+#ifndef JPEG_IMAGE_CHECKS
+#ifdef NDEBUG
+#define JPEG_IMAGE_CHECKS 0
+#else
+#define JPEG_IMAGE_CHECKS 1
+#endif
+#endif
+
+struct CheckedAccess {
+    static void check(const bool ok, const char* message) {
+        if (!ok) throw std::out_of_range(message);
+    }
+};
+
+struct UncheckedAccess {
+    static void check(const bool, const char*) { }
+};
+
+#if JPEG_IMAGE_CHECKS
+typedef CheckedAccess DefaultImageAccess;
+#else
+typedef UncheckedAccess DefaultImageAccess;
+#endif
+
+/// walks the row pointers of an image whose rows are `stride` elements apart
+template <typename T>
+class RowIterator {
+public:
+    RowIterator(T* row, const size_t stride): _row(row), _stride(stride) { }
+    T* operator*() const { return _row; }
+    RowIterator& operator++() { _row += _stride; return *this; }
+    bool operator==(const RowIterator& rhs) const { return _row == rhs._row; }
+    bool operator!=(const RowIterator& rhs) const { return _row != rhs._row; }
+private:
+    T* _row;
+    size_t _stride;
+};
+
+/// all rows of an image, for (uint8_t* row : img.rowRange()) { ... }
+template <typename T>
+class RowRange {
+public:
+    RowRange(T* first, const size_t rows, const size_t stride): _first(first), _rows(rows), _stride(stride) { }
+    RowIterator<T> begin() const { return RowIterator<T>(_first, _stride); }
+    RowIterator<T> end() const { return RowIterator<T>(_first + _rows * _stride, _stride); }
+private:
+    T* _first;
+    size_t _rows;
+    size_t _stride;
+};
+
 ///
 /// the Image object is stored as continous HWC format 
 ///
 ///
-template <typename Dtype>
+template <typename Dtype, typename Access = DefaultImageAccess>
 class Image {
 private:
     int _rows;
@@ -60,6 +119,7 @@ public:
     Image(const char* filename) {
         uint8_t* data = read_stb_rgb(filename, _cols, _rows, _channels); 
         ASSERT(data, "Failed to open rgb image:" + std::string(filename));
+        _channels = 3; // converted to RGB whatever the file holds
         _data.resize(_rows * _cols * _channels);
         std::memcpy(_data.data(), data, _rows * _cols * _channels * sizeof(Dtype));
         free(data);
@@ -76,8 +136,9 @@ public:
         rhs._rows = 0; rhs._cols = 0; rhs._channels = 0; 
     }
     // copy assignment operator
-    Image& operator=(Image rhs) noexcept {
-        this->swap(rhs); 
+    Image& operator=(const Image& rhs) {
+        Image tmp(rhs);
+        this->swap(tmp); 
         return *this;
     }
     // move assignment operator
@@ -95,8 +156,8 @@ public:
     }    
 
 public:
-    template <typename U>
-    void copyFrom(const Image<U> &rhs) {
+    template <typename U, typename A>
+    void copyFrom(const Image<U, A> &rhs) {
         //Image<Dtype> tmp(rhs.rows(), rhs.cols(), rhs.channels());
         //for(size_t y = 0; y < rhs.rows(); ++y) {
         //    for(size_t x = 0; x < rhs.cols(); ++x) {
@@ -107,7 +168,7 @@ public:
         //}
         //this->swap(tmp); 
         if (_rows != rhs.rows() || _cols != rhs.cols() || _channels != rhs.channels()) {
-            _data.reserve(rhs.numel());
+            _data.resize(rhs.numel());
             _rows = rhs.rows(); _cols = rhs.cols(); _channels = rhs.channels(); 
         }
         std::transform(rhs.data(), rhs.data() + rhs.numel(), _data.begin(),
@@ -121,18 +182,30 @@ public:
     const Dtype* data() const { return _data.data();}
     
     Dtype& operator()(size_t y, size_t x, size_t c) {
-        ASSERT(x >= 0 && x < _cols && y >= 0 && y < _rows
-              && c >= 0 && c < _channels,
-              "make sure x: [0, cols), y: [0, rows), c:[0, channels) !");
-        return _data[y * _cols * _channels + x * _channels + c];      
+        Access::check(inBounds(y, x, c), "make sure x: [0, cols), y: [0, rows), c:[0, channels) !");
+        return _data[(y * _cols + x) * _channels + c];
     }
     const Dtype& operator()(size_t y, size_t x, size_t c) const {
-        ASSERT(x >= 0 && x < _cols && y >= 0 && y < _rows
-              && c >= 0 && c < _channels,
-              "make sure x: [0, cols), y: [0, rows), c:[0, channels) !");
-        return _data[y * _cols * _channels + x * _channels + c];      
+        Access::check(inBounds(y, x, c), "make sure x: [0, cols), y: [0, rows), c:[0, channels) !");
+        return _data[(y * _cols + x) * _channels + c];
+    }
+    /// always checked, whatever the policy
+    Dtype& at(size_t y, size_t x, size_t c) {
+        CheckedAccess::check(inBounds(y, x, c), "make sure x: [0, cols), y: [0, rows), c:[0, channels) !");
+        return _data[(y * _cols + x) * _channels + c];
+    }
+    const Dtype& at(size_t y, size_t x, size_t c) const {
+        CheckedAccess::check(inBounds(y, x, c), "make sure x: [0, cols), y: [0, rows), c:[0, channels) !");
+        return _data[(y * _cols + x) * _channels + c];
     }
 
+    /// row pointers for kernels, never checked
+    size_t stride() const { return size_t(_cols) * _channels; }
+    Dtype* row(size_t y) { return _data.data() + y * stride(); }
+    const Dtype* row(size_t y) const { return _data.data() + y * stride(); }
+    RowRange<Dtype> rowRange() { return RowRange<Dtype>(_data.data(), _rows, stride()); }
+    RowRange<const Dtype> rowRange() const { return RowRange<const Dtype>(_data.data(), _rows, stride()); }
+
     // create a copy of the image with the same dimensions and pixel type
     Image clone() const {
         Image out(_rows, _cols, _channels);
@@ -141,12 +214,12 @@ public:
     }
     // subscript operator for 2D access
     Dtype* operator[](int row) {
-        ASSERT(row >= 0 && row < _rows, "row index out of bounds!");
-        return &_data[row * _cols * _channels];
+        Access::check(row >= 0 && row < _rows, "row index out of bounds!");
+        return _data.data() + size_t(row) * stride();
     }
     const Dtype* operator[](int row) const {
-        ASSERT(row >= 0 && row < _rows, "row index out of bounds!");
-        return &_data[row * _cols * _channels];
+        Access::check(row >= 0 && row < _rows, "row index out of bounds!");
+        return _data.data() + size_t(row) * stride();
     }
 
     // This member function is only available when Dtype is uint8_t
@@ -159,38 +232,144 @@ public:
     }
 
     Dtype get_pixel(const int y, const int x, const int c) const {
-       ASSERT(this->data() != nullptr, "empty image");
-       ASSERT(c >= 0 && c < _channels, "check input channel !");
+       Access::check(this->data() != nullptr, "empty image");
+       Access::check(c >= 0 && c < _channels, "check input channel !");
 
-       return (x >= 0 && x <_cols && y >= 0 && y < _rows) ? (*this)(y, x, c) : 0;
+       return (x >= 0 && x <_cols && y >= 0 && y < _rows) ? _data[(size_t(y) * _cols + x) * _channels + c] : 0;
     }
 
+    ///
+    /// average of sx x sy cells over the window [x0, x1) x [y0, y1), pixels outside
+    /// the image count as 0; walks row pointers, integer images sum in integers
+    ///
     Image roi_sampling(const int x0, const int y0, const int x1, const int y1,
                        const int sx, const int sy, std::vector<int> channels) const {
         ASSERT(this->data() != nullptr && this->numel() > 0, " image is empty!");
         ASSERT(sx >= 1 && sy >= 1, "sampling factor sx/sy < 1 !");
+        for (int c : channels) {
+            CheckedAccess::check(c >= 0 && c < _channels, "check input channel !");
+        }
+        typedef typename std::conditional<std::is_floating_point<Dtype>::value, float, long long>::type Acc;
 
-        int dw = (x1 - x0) / sx;
-        int dh = (y1 - y0) / sy; 
+        const int dw = (x1 - x0) / sx;
+        const int dh = (y1 - y0) / sy;
+        const Acc area = sx * sy;
         Image dst(dh, dw, channels.size());
 
-        for(size_t y = 0; y < y1 - y0; y += sy) {
-            for(size_t x = 0; x < x1 - x0; x += sx) {
-                for(int c = 0; c < dst._channels; ++c) {
-                    float val = 0;
-                    for(int j = 0; j < sy; ++j) {
-                        for(int i = 0; i < sx; ++i) {
-                            val += get_pixel(y0+y+j, x0+x+i, channels[c]);  
+        for (int dy = 0; dy < dh; ++dy) {
+            Dtype* out = dst.row(dy);
+            for (int dx = 0; dx < dw; ++dx) {
+                for (size_t c = 0; c < channels.size(); ++c) {
+                    Acc val = 0;
+                    for (int j = 0; j < sy; ++j) {
+                        const int y = y0 + dy * sy + j;
+                        if (y < 0 || y >= _rows) continue;
+                        const Dtype* src = row(y);
+                        for (int i = 0; i < sx; ++i) {
+                            const int x = x0 + dx * sx + i;
+                            if (x >= 0 && x < _cols) val += src[size_t(x) * _channels + channels[c]];
                         }
                     }
-                    val /= (sx*sy);
-                    dst(int(y/sy), int(x/sx), c) = static_cast<Dtype>(val);
+                    out[size_t(dx) * channels.size() + c] = static_cast<Dtype>(val / area);
                 }
             }
         }
         return dst;
      }
 
+private:
+    bool inBounds(size_t y, size_t x, size_t c) const {
+        return y < size_t(_rows) && x < size_t(_cols) && c < size_t(_channels);
+    }
+
 }; // end of class Image
 
+///
+/// non-owning, read-only view of HWC pixels with a row stride: row y starts at
+/// data + y * stride (in elements, stride >= cols * channels), so padded rows of
+/// external buffers (numpy slices, mmap'ed files, camera frames) are read in place.
+/// An Image converts to a view implicitly; the viewed memory must outlive the view.
+///
+template <typename Dtype>
+class ImageView {
+public:
+    ImageView(): _data(nullptr), _rows(0), _cols(0), _channels(0), _stride(0) { }
+    /// stride 0: rows are contiguous
+    ImageView(const Dtype* data, const int rows, const int cols, const int channels, const size_t stride = 0):
+        _data(data), _rows(rows), _cols(cols), _channels(channels),
+        _stride(stride ? stride : size_t(cols) * channels) {
+        ASSERT(rows > 0 && cols > 0 && channels > 0, "rows/cols/channels must be greater than zero !");
+        ASSERT(_stride >= size_t(cols) * channels, "row stride must cover cols * channels !");
+    }
+    template <typename Access>
+    ImageView(const Image<Dtype, Access> &image):
+        _data(image.data()), _rows(image.rows()), _cols(image.cols()), _channels(image.channels()),
+        _stride(image.cols() * image.channels()) { }
+
+    size_t rows() const { return _rows; }
+    size_t cols() const { return _cols; }
+    size_t channels() const { return _channels; }
+    size_t stride() const { return _stride; }
+    bool empty() const { return _data == nullptr || _rows == 0 || _cols == 0; }
+    bool contiguous() const { return _stride == _cols * _channels; }
+
+    const Dtype* data() const { return _data; }
+    const Dtype* row(const size_t y) const { return _data + y * _stride; }
+    RowRange<const Dtype> rowRange() const { return RowRange<const Dtype>(_data, _rows, _stride); }
+    const Dtype& operator()(size_t y, size_t x, size_t c) const {
+        DefaultImageAccess::check(x < _cols && y < _rows && c < _channels,
+                                  "make sure x: [0, cols), y: [0, rows), c:[0, channels) !");
+        return _data[y * _stride + x * _channels + c];
+    }
+
+    /// the rows x cols window at (y0, x0), same memory and stride
+    ImageView crop(const int y0, const int x0, const int rows, const int cols) const {
+        ASSERT(y0 >= 0 && x0 >= 0 && y0 + rows <= int(_rows) && x0 + cols <= int(_cols),
+               "crop window out of bounds!");
+        return ImageView(row(y0) + size_t(x0) * _channels, rows, cols, _channels, _stride);
+    }
+
+private:
+    const Dtype* _data;
+    size_t _rows;
+    size_t _cols;
+    size_t _channels;
+    size_t _stride;
+};
+
+///
+/// RGB pixels decoded by stb_image, owned as returned by the decoder: view()
+/// reads them in place where Image(const char*) would copy them
+///
+class StbImage {
+public:
+    StbImage(): _data(nullptr), _rows(0), _cols(0) { }
+    /// decode as 3-channel RGB, throws std::runtime_error if the file cannot be decoded
+    explicit StbImage(const char* filename);
+    ~StbImage() { free(_data); }
+
+    StbImage(const StbImage&) = delete;
+    StbImage& operator=(const StbImage&) = delete;
+    StbImage(StbImage&& rhs) noexcept: _data(rhs._data), _rows(rhs._rows), _cols(rhs._cols) {
+        rhs._data = nullptr; rhs._rows = 0; rhs._cols = 0;
+    }
+    StbImage& operator=(StbImage&& rhs) noexcept {
+        if (this != &rhs) {
+            free(_data);
+            _data = rhs._data; _rows = rhs._rows; _cols = rhs._cols;
+            rhs._data = nullptr; rhs._rows = 0; rhs._cols = 0;
+        }
+        return *this;
+    }
+
+    size_t rows() const { return _rows; }
+    size_t cols() const { return _cols; }
+    ImageView<uint8_t> view() const { return _data ? ImageView<uint8_t>(_data, _rows, _cols, 3) : ImageView<uint8_t>(); }
+
+private:
+    uint8_t* _data;
+    int _rows;
+    int _cols;
+};
+
 // end of file
@@ -2,8 +2,17 @@
 #include <pybind11/stl.h>
 #include <pybind11/numpy.h>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "JpegIO.hpp"
 #include "HuffmanCodec.hpp"
+#include "JpegEncoder.hpp"
+#include "JpegSink.hpp"
+#include "JpegThreadPool.hpp"
 //#include "JpegDCT.hpp"
 
 #include "image.hpp"
@@ -11,11 +20,227 @@
 namespace py = pybind11;
 using namespace std;
 
+///
+/// an (rows, cols, 3) uint8 buffer (numpy array, Image, ...) as an ImageView of its
+/// own memory, no copy: the pixels of a row must be packed RGB, the rows may be
+/// strided (slices, crops). The buffer_info must outlive the view.
+///
+static ImageView<uint8_t> rgbView(const py::buffer_info &image) {
+    if (image.itemsize != 1 || image.format != py::format_descriptor<uint8_t>::format()) {
+        throw py::type_error("image must hold uint8 pixels");
+    }
+    if (image.ndim != 3 || image.shape[2] != 3) {
+        throw py::value_error("image must have shape (rows, cols, 3)");
+    }
+    const ssize_t rows = image.shape[0], cols = image.shape[1];
+    if (rows < 1 || cols < 1 || rows > 65535 || cols > 65535) {
+        throw py::value_error("image rows and cols must be in [1, 65535]");
+    }
+    // the strides of single-element dimensions carry no meaning
+    const ssize_t rowStride = rows > 1 ? image.strides[0] : 3 * cols;
+    if (image.strides[2] != 1 || (cols > 1 && image.strides[1] != 3) || rowStride < 3 * cols) {
+        throw py::value_error("image rows must hold packed RGB pixels, see numpy.ascontiguousarray");
+    }
+    return ImageView<uint8_t>(static_cast<const uint8_t*>(image.ptr), int(rows), int(cols), 3, size_t(rowStride));
+}
+
+///
+/// a JpegEncoder context for Python: quantizer, tables, coefficient planes and the
+/// output buffer are reused from one call to the next. The GIL is released while
+/// encoding, calls on the same object from several threads take turns.
+///
+class PyJpegEncoder {
+public:
+    PyJpegEncoder(const bool optimizeHuffman, const bool progressive) {
+        mEncoder.setVerbose(false);
+        mEncoder.setOptimizeHuffman(optimizeHuffman);
+        mEncoder.setProgressive(progressive);
+    }
+
+    py::bytes encode(const py::buffer &image, const int quality, YUVFormat format) {
+        // the exported buffer pins the pixels until it is released, with the GIL held, on return
+        const py::buffer_info pixels = image.request();
+        const ImageView<uint8_t> rgb = rgbView(pixels);
+        // the lock is only ever taken without the GIL, and held until the output is copied
+        std::unique_lock<std::mutex> lock(mMutex, std::defer_lock);
+        {
+            py::gil_scoped_release release;
+            lock.lock();
+            mOutput.data().clear(); // keeps the capacity
+            mEncoder.encodeRGB(rgb, quality, format, mOutput);
+        }
+        const std::vector<uint8_t> &jpeg = mOutput.data();
+        return py::bytes(reinterpret_cast<const char*>(jpeg.data()), jpeg.size());
+    }
+
+private:
+    JpegEncoder mEncoder;
+    MemorySink mOutput;
+    std::mutex mMutex;
+};
+/// (N, 64) quantized blocks in zigzag order, converted to contiguous int16 if needed
+typedef py::array_t<int16_t, py::array::c_style | py::array::forcecast> CoefficientBlocks;
+
+///
+/// HuffmanCodec for Python: encode() runs without the GIL, under a per-object mutex
+/// that is only ever taken without the GIL. getResult() views point into the codec's
+/// buffers, which the next encode overwrites or frees, so they are counted and
+/// encode() raises BufferError while any is alive (as bytearray does on resize).
+///
+class PyHuffmanCodec {
+public:
+    long encode(const int16_t* y, const int16_t* u, const int16_t* v, const int w, const int h, YUVFormat format) {
+        long length = 0;
+        bool exported;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mMutex);
+            exported = mExports > 0;
+            if (!exported) length = mCodec.encode(y, u, v, w, h, format);
+        }
+        if (exported) {
+            throw py::buffer_error("HuffmanCodec.encode: views of the previous scan from getResult() are still alive");
+        }
+        return length;
+    }
+
+    static py::memoryview result(py::object self, const py::ssize_t data_len);
 
+private:
+    friend class PyHuffmanScan;
+    HuffmanCodec mCodec;
+    std::mutex mMutex;
+    std::atomic<int> mExports{0}; // live PyHuffmanScan objects
+};
+
+/// the scan of a PyHuffmanCodec while it is viewed, holds the codec and its export count
+class PyHuffmanScan {
+public:
+    explicit PyHuffmanScan(py::object codec): data(nullptr), size(0),
+        mOwner(std::move(codec)), mCodec(mOwner.cast<PyHuffmanCodec*>()), mCounted(false) { }
+    ~PyHuffmanScan() {
+        if (mCounted) mCodec->mExports--;
+    }
+    PyHuffmanScan(const PyHuffmanScan&) = delete;
+    PyHuffmanScan& operator=(const PyHuffmanScan&) = delete;
+
+    /// take the codec's result and count the export, called without the GIL
+    void acquire() {
+        static const char empty = 0;
+        std::lock_guard<std::mutex> lock(mCodec->mMutex);
+        const char* result = mCodec->mCodec.getResult(); // joins chunked output once
+        data = result ? result : &empty;
+        size = mCodec->mCodec.resultSize();
+        mCodec->mExports++;
+        mCounted = true;
+    }
+
+    const char* data;
+    size_t size;
+
+private:
+    py::object mOwner; // keeps the codec alive
+    PyHuffmanCodec* mCodec;
+    bool mCounted;
+};
+
+py::memoryview PyHuffmanCodec::result(py::object self, const py::ssize_t data_len) {
+    std::unique_ptr<PyHuffmanScan> scan(new PyHuffmanScan(self));
+    {
+        py::gil_scoped_release release;
+        scan->acquire();
+    }
+    const py::ssize_t size = py::ssize_t(scan->size);
+    if (data_len > size) {
+        throw py::value_error("data_len " + std::to_string(data_len) + " exceeds the " +
+                              std::to_string(size) + " encoded bytes");
+    }
+    py::memoryview view(py::cast(scan.release(), py::return_value_policy::take_ownership));
+    if (data_len < 0 || data_len == size) {
+        return view;
+    }
+    return py::memoryview(view[py::slice(0, data_len, 1)]);
+}
 
+///
+/// the module's worker pool for encode_batch, created on first use and rebuilt only
+/// when another thread count is asked for; every worker keeps its own encoder
+/// context. Batches run one at a time, each one already uses all workers.
+///
+struct PyJpegBatchPool {
+    std::mutex mutex;
+    int threads = -1;
+    std::unique_ptr<JpegThreadPool> pool;
+    std::vector<std::unique_ptr<JpegEncoder>> encoders;
 
+    static PyJpegBatchPool& instance() {
+        static PyJpegBatchPool batchPool;
+        return batchPool;
+    }
 
+    /// called with the mutex held
+    void configure(const int requestedThreads, const bool optimizeHuffman, const bool progressive) {
+        if (!pool || threads != requestedThreads) {
+            pool.reset(); // joins the old workers
+            pool.reset(new JpegThreadPool(requestedThreads));
+            threads = requestedThreads;
+            encoders.clear();
+            for (int i = 0; i < pool->size(); ++i) {
+                encoders.emplace_back(new JpegEncoder());
+                encoders.back()->setVerbose(false);
+            }
+        }
+        for (auto &encoder : encoders) {
+            encoder->setOptimizeHuffman(optimizeHuffman);
+            encoder->setProgressive(progressive);
+        }
+    }
+};
 
+static py::list encodeBatch(const std::vector<py::buffer> &images, const int quality, YUVFormat format,
+                            const int threads, const bool optimizeHuffman, const bool progressive) {
+    // the buffers are exported with the GIL held and pin the pixels until the return
+    std::vector<py::buffer_info> pixels;
+    std::vector<ImageView<uint8_t>> views;
+    pixels.reserve(images.size());
+    views.reserve(images.size());
+    for (const py::buffer &image : images) {
+        pixels.push_back(image.request());
+        views.push_back(rgbView(pixels.back()));
+    }
+    std::vector<std::vector<uint8_t>> outputs(views.size());
+    std::vector<std::string> errors(views.size());
+    {
+        py::gil_scoped_release release;
+        PyJpegBatchPool &batchPool = PyJpegBatchPool::instance();
+        std::lock_guard<std::mutex> lock(batchPool.mutex);
+        batchPool.configure(threads, optimizeHuffman, progressive);
+        for (size_t i = 0; i < views.size(); ++i) {
+            batchPool.pool->submit([&, i](int worker) {
+                // failures stay with their image, the pool never sees an exception
+                try {
+                    MemorySink sink;
+                    batchPool.encoders[worker]->encodeRGB(views[i], quality, format, sink);
+                    outputs[i].swap(sink.data());
+                } catch (const std::exception &ex) {
+                    errors[i] = ex.what();
+                }
+            });
+        }
+        batchPool.pool->wait();
+    }
+    for (size_t i = 0; i < errors.size(); ++i) {
+        if (!errors[i].empty()) {
+            throw std::runtime_error("image " + std::to_string(i) + ": " + errors[i]);
+        }
+    }
+    py::list result;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        result.append(py::bytes(reinterpret_cast<const char*>(outputs[i].data()), outputs[i].size()));
+        std::vector<uint8_t>().swap(outputs[i]);
+    }
+    return result;
+}
 
 // Binding code
 PYBIND11_MODULE(jpeg_py, m) {
@@ -26,16 +251,67 @@ PYBIND11_MODULE(jpeg_py, m) {
             .value("YUV422", YUVFormat::YUV422)
             .export_values();
 
-    m.def("read_rgb_image", [](const char* file) {
-          int w, h, c;
-          uint8_t* data = read_stb_rgb(file, w, h, c);
-          ASSERT(data, " Failed to open rgb image:" + std::string(file));  
-          py::array dst = py::memoryview::from_buffer(
-                  data,                                    // buffer pointer
-                { h, w, c },                                  // shape (rows, cols)
-                { sizeof(uint8_t) * w * c, sizeof(uint8_t) * c, sizeof(uint8_t) }   // strides in bytes
-             );
-          return dst;
+    m.def("encode", [](const py::buffer &image, const int quality, YUVFormat format) {
+          // one context per calling thread, so its buffers are reused across calls
+          static thread_local PyJpegEncoder encoder(false, false);
+          return encoder.encode(image, quality, format);
+        }, "encode an (rows, cols, 3) uint8 RGB array or Image into JPEG bytes, the GIL is released meanwhile",
+        py::arg("image"), py::arg("quality") = 50, py::arg("format") = YUVFormat::YUV444);
+
+    py::class_<PyJpegEncoder>(m, "Encoder")
+        .def(py::init<bool, bool>(),
+             "a persistent encoder context, buffers are reused between calls",
+             py::arg("optimize_huffman") = false, py::arg("progressive") = false)
+        .def("encode", &PyJpegEncoder::encode,
+             "encode an (rows, cols, 3) uint8 RGB array or Image into JPEG bytes, the GIL is released meanwhile",
+             py::arg("image"), py::arg("quality") = 50, py::arg("format") = YUVFormat::YUV444);
+
+    m.def("encode_batch", &encodeBatch,
+          "encode a list of (rows, cols, 3) uint8 RGB arrays or Images on the module's native thread pool, "
+          "returns a list of JPEG bytes in input order; threads <= 0: all cores",
+          py::arg("images"), py::arg("quality") = 50, py::arg("format") = YUVFormat::YUV444,
+          py::arg("threads") = 0, py::arg("optimize_huffman") = false, py::arg("progressive") = false);
+
+    m.def("read_rgb_image", [](const std::string &file) {
+          std::unique_ptr<StbImage> decoded;
+          {
+              py::gil_scoped_release release;
+              decoded.reset(new StbImage(file.c_str()));
+          }
+          const ImageView<uint8_t> pixels = decoded->view();
+          // the array owns the decoder's buffer through the capsule, which frees it
+          // together with the last array that references it
+          py::capsule owner(decoded.get(), [](void* image) { delete static_cast<StbImage*>(image); });
+          decoded.release();
+          return py::array_t<uint8_t>(
+                { ssize_t(pixels.rows()), ssize_t(pixels.cols()), ssize_t(3) },           // shape
+                { ssize_t(pixels.stride()), ssize_t(3), ssize_t(1) },                     // strides in bytes
+                pixels.data(), owner);
+        }, "decode an image file into an (rows, cols, 3) uint8 RGB array, without copying",
+        py::arg("file"));
+
+    py::class_<Image<uint8_t>>(m, "Image", py::buffer_protocol())
+        .def(py::init([](const std::string &file) {
+            // StbImage reports decode errors as exceptions, ASSERT may be compiled out
+            StbImage decoded(file.c_str());
+            const ImageView<uint8_t> pixels = decoded.view();
+            return new Image<uint8_t>(pixels.data(), int(pixels.rows()), int(pixels.cols()), 3);
+        }), "decode an image file as RGB", py::arg("file"))
+        .def(py::init([](const int rows, const int cols, const int channels) {
+            if (rows < 1 || cols < 1 || channels < 1) {
+                throw py::value_error("rows, cols and channels must be positive");
+            }
+            return new Image<uint8_t>(rows, cols, channels);
+        }), "a zero-filled image", py::arg("rows"), py::arg("cols"), py::arg("channels") = 3)
+        .def_property_readonly("rows", &Image<uint8_t>::rows)
+        .def_property_readonly("cols", &Image<uint8_t>::cols)
+        .def_property_readonly("channels", &Image<uint8_t>::channels)
+        // numpy.asarray(image) shares the pixels and keeps the Image alive
+        .def_buffer([](Image<uint8_t> &image) -> py::buffer_info {
+            return py::buffer_info(
+                image.data(), sizeof(uint8_t), py::format_descriptor<uint8_t>::format(), 3,
+                { image.rows(), image.cols(), image.channels() },
+                { image.stride(), image.channels(), size_t(1) });
         });
 
     /*
@@ -60,18 +336,29 @@ PYBIND11_MODULE(jpeg_py, m) {
         .def(py::init<>())
         .def_static("writeToFile",
             [](
-                 const std::string& dst_file, py::array_t<char, py::array::c_style | py::array::forcecast> &buffer,
+                 const std::string& dst_file, const py::buffer &buffer,
                  const std::vector<std::vector<int>>& quant_tab,
                  const std::vector<std::vector<uint8_t>>& huf_ac_tab,
                  const std::vector<std::vector<uint8_t>>& huf_dc_tab,
                  int w, int h, YUVFormat format) {
+             // any contiguous byte buffer: HuffmanCodec.getResult(), bytes, a numpy array
+             const py::buffer_info scan = buffer.request();
+             if (scan.itemsize != 1 || scan.ndim != 1 || (scan.shape[0] > 1 && scan.strides[0] != 1)) {
+                throw py::value_error("buffer must be a contiguous 1-D byte buffer");
+             }
              // Get pointers to the underlying data of the vectors
              const int* quant_ptr[2] = {quant_tab[0].data(), quant_tab[1].data()};
              const uint8_t* huf_ac_ptr[2] = {huf_ac_tab[0].data(), huf_ac_tab[1].data()};
              const uint8_t* huf_dc_ptr[2] = {huf_dc_tab[0].data(), huf_dc_tab[1].data()};
 
              // Call the C++ function with the pointers
-             JpegIO::writeToFile(dst_file.c_str(), buffer.data(), buffer.size(), quant_ptr, huf_ac_ptr, huf_dc_ptr, w, h, format);
+             py::gil_scoped_release release;
+             FdSink sink(dst_file.c_str());
+             bool ok = JpegIO::writeJpeg(sink, static_cast<const char*>(scan.ptr), scan.shape[0],
+                                         quant_ptr, huf_ac_ptr, huf_dc_ptr, w, h, format);
+             if (!sink.close() || !ok) {
+                throw std::runtime_error("failed to write " + dst_file + ": " + sink.error());
+             }
              }, 
             "Write JPEG image to file.",
             py::arg("dst_file"),
@@ -85,29 +372,31 @@ PYBIND11_MODULE(jpeg_py, m) {
         );
 
  
-    py::class_<HuffmanCodec>(m, "HuffmanCodec")
+    py::class_<PyHuffmanCodec>(m, "HuffmanCodec")
         .def(py::init<>())
-        .def("encode", [](HuffmanCodec &self,
-                          const py::array_t<int, py::array::c_style | py::array::forcecast> &y_blocks,
-                          const py::array_t<int, py::array::c_style | py::array::forcecast> &u_blocks,
-                          const py::array_t<int, py::array::c_style | py::array::forcecast> &v_blocks,
+        .def("encode", [](PyHuffmanCodec &self,
+                          const CoefficientBlocks &y_blocks, const CoefficientBlocks &u_blocks,
+                          const CoefficientBlocks &v_blocks,
                           int w, int h, YUVFormat format) {
-            if (y_blocks.ndim() != 2 || y_blocks.shape(1) != 64) {
-                throw std::runtime_error("y_blocks must have shape (N, 64)");
-            }
-            if (u_blocks.ndim() != 2 || u_blocks.shape(1) != 64) {
-                throw std::runtime_error("u_blocks must have shape (N, 64)");
+            if (w < 1 || h < 1 || w > 65535 || h > 65535) {
+                throw py::value_error("width and height must be in [1, 65535]");
             }
-            if (v_blocks.ndim() != 2 || v_blocks.shape(1) != 64) {
-                throw std::runtime_error("v_blocks must have shape (N, 64)");
+            // encode walks the whole MCU grid, every plane must hold all of its blocks
+            size_t lumaBlocks, chromaBlocks;
+            HuffmanCodec::blockCounts(w, h, format, lumaBlocks, chromaBlocks);
+            const CoefficientBlocks* planes[3] = {&y_blocks, &u_blocks, &v_blocks};
+            const char* names[3] = {"y_blocks", "u_blocks", "v_blocks"};
+            for (int c = 0; c < 3; ++c) {
+                const size_t count = c == 0 ? lumaBlocks : chromaBlocks;
+                if (planes[c]->ndim() != 2 || planes[c]->shape(1) != 64 || size_t(planes[c]->shape(0)) != count) {
+                    throw py::value_error(std::string(names[c]) + " must have shape (" + std::to_string(count) +
+                                          ", 64) for this width, height and format");
+                }
             }
-
-            const int n = y_blocks.shape(0);
-            const int *y_ptr = y_blocks.data();
-            const int *u_ptr = u_blocks.data();
-            const int *v_ptr = v_blocks.data();
-            return self.encode(y_ptr, u_ptr, v_ptr, w, h, format);
-        }, "Huffman encode for blocks", 
+            // the arguments keep the arrays alive while the GIL is released
+            return self.encode(y_blocks.data(), u_blocks.data(), v_blocks.data(), w, h, format);
+        }, "Huffman encode for blocks, the GIL is released meanwhile; raises BufferError while "
+           "views of the previous scan from getResult() are alive",
         py::arg("y_blocks"), 
         py::arg("u_blocks"), 
         py::arg("v_blocks"), 
@@ -115,15 +404,19 @@ PYBIND11_MODULE(jpeg_py, m) {
         py::arg("height"), 
         py::arg("format") 
         )
-        .def("getResult", [](HuffmanCodec &self, const int data_len) {
-            char* tmp = self.getResult(); 
-            py::array_t<char, py::array::c_style | py::array::forcecast> dst(data_len);
-            py::buffer_info buf = dst.request();
-            char* ptr = static_cast<char*>(buf.ptr);
-            for(size_t i = 0; i < data_len; ++i) ptr[i] = tmp[i];
-            return dst;
-         }, "get encoded bytes" 
+        .def("getResult", &PyHuffmanCodec::result,
+            "the encoded bytes as a read-only memoryview of the codec's buffer, no copy; "
+            "data_len (optional) must not exceed the encoded length. The codec refuses to "
+            "encode until every view (and slice of one) is released",
+            py::arg("data_len") = -1
         );
+
+    // the exporter behind getResult() views, every view and slice holds a reference
+    py::class_<PyHuffmanScan>(m, "HuffmanScan", py::buffer_protocol())
+        .def_buffer([](PyHuffmanScan &scan) -> py::buffer_info {
+            return py::buffer_info(const_cast<char*>(scan.data), 1, py::format_descriptor<uint8_t>::format(), 1,
+                                   { py::ssize_t(scan.size) }, { py::ssize_t(1) }, true);
+        });
  
 }
 
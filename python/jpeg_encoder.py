@@ -270,7 +270,7 @@ print(Qt)
 
 
 # do quantization 
-blocks_quantized = [(e / Qt[ch]).round().astype(np.int32) for ch, e in enumerate(blocks_dct)]
+blocks_quantized = [(e / Qt[ch]).round().astype(np.int16) for ch, e in enumerate(blocks_dct)]
 
 print("quantized coeff ", blocks_quantized[0][:3])
 
@@ -349,7 +349,7 @@ print("Compression ratio:",  H*W*C/data_len)
 
 
 encoded_img = huffman_coder.getResult(data_len)
-print(len(encoded_img), encoded_img.dtype)
+print(len(encoded_img), encoded_img.format)
 
 
 # In[13]:
@@ -16,9 +16,15 @@ setup(
             'jpeg_py',
             sources=[
                 'python/bind.cpp', 
+                'src/JpegEncoder.cpp',
+                'src/JpegThreadPool.cpp',
                 'src/HuffmanCodec.cpp',
+                'src/JpegProgressive.cpp',
                 'src/JpegIO.cpp',
+                'src/JpegSink.cpp',
                 'src/JpegZigzag.cpp',
+                'src/JpegDCT.cpp',
+                'src/JpegQuant.cpp',
                 'src/JpegColor.cpp',
                 'src/image.cpp',
                 '3rdparty/bitstr.cpp'
@@ -28,7 +34,8 @@ setup(
                 'pybind11/include'
             ],
             language='c++',
-            extra_compile_args=['-std=c++14', '-O3']
+            extra_compile_args=['-std=c++14', '-O3', '-pthread'],
+            extra_link_args=['-pthread']
         )
     ],
     cmdclass={
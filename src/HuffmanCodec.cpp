@@ -1,7 +1,16 @@
 #include <cstdlib>
 #include "HuffmanCodec.hpp"
-#include "../3rdparty/bitstr.h"
+#include "JpegThreadPool.hpp"
 #include <stdexcept>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#ifdef JPEG_X86_SIMD
+#include <immintrin.h>
+#endif
 
 const uint8_t HuffmanCodec::STD_HUFTAB_LUMIN_AC[] = {
         0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7d,
@@ -40,104 +49,150 @@ const uint8_t HuffmanCodec::STD_HUFTAB_CHROM_DC[] = {
         0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
 };
 
-HuffmanCodec::HuffmanCodec() : mBitStream(nullptr) {
+HuffmanCodec::HuffmanCodec() : mBuffer(nullptr), mBufferSize(0), mDcCache{0, 0, 0},
+                               mRestartRows(0), mThreads(1), mStandardTables(false) {
+    resetTables();
+}
+
+static int tableIndex(bool dc, bool luminance) {
+    return (dc ? 0 : 2) + (luminance ? 0 : 1);
+}
+
+void HuffmanCodec::resetTables() {
+    if (mStandardTables) return;
+    const uint8_t* std_tabs[4] = {STD_HUFTAB_LUMIN_DC, STD_HUFTAB_CHROM_DC,
+                                  STD_HUFTAB_LUMIN_AC, STD_HUFTAB_CHROM_AC};
+    for (int t = 0; t < 4; ++t) {
+        int n = 16;
+        for (int i = 0; i < 16; ++i) n += std_tabs[t][i];
+        std::memcpy(mHufTables[t], std_tabs[t], n);
+    }
     initCodeList(true, true);
     initCodeList(true, false);
     initCodeList(false, true);
     initCodeList(false, false);
+    mStandardTables = true;
+}
+
+const uint8_t* HuffmanCodec::huffmanTable(bool dc, bool luminance) const {
+    return mHufTables[tableIndex(dc, luminance)];
 }
 
 void HuffmanCodec::initCodeList(bool dc, bool luminance) {
-    int i, j, k;
-    int symbol;
-    int code;
-    uint8_t hufsize[256];
-    int hufcode[256];
-    int tabsize;
-
-    k = 0;
-    code = 0x00;
-    const uint8_t *hufTable;
+    const uint8_t *hufTable = mHufTables[tableIndex(dc, luminance)];
     HUFCODEITEM *codeList;
+    uint32_t *packed;
     if (dc && luminance) {
-        hufTable = STD_HUFTAB_LUMIN_DC;
         codeList = mCodeListDCLumin;
+        packed = mDCCodes[0];
     } else if (dc && !luminance) {
-        hufTable = STD_HUFTAB_CHROM_DC;
         codeList = mCodeListDCChrom;
+        packed = mDCCodes[1];
     } else if (!dc && luminance) {
-        hufTable = STD_HUFTAB_LUMIN_AC;
         codeList = mCodeListACLumin;
+        packed = mACCodes[0];
     } else {
-        hufTable = STD_HUFTAB_CHROM_AC;
         codeList = mCodeListACChrom;
+        packed = mACCodes[1];
     }
-    for (i = 0; i < MAX_HUFFMAN_CODE_LEN; i++) {
-        for (j = 0; j < hufTable[i]; j++) {
-            hufsize[k] = i + 1;
-            hufcode[k] = code;
+    buildCodes(hufTable, packed);
+    std::memset(codeList, 0, sizeof(HUFCODEITEM) * 256);
+    for (int symbol = 0; symbol < 256; symbol++) {
+        if (packed[symbol] == 0) continue;
+        codeList[symbol].symbol = symbol;
+        codeList[symbol].depth = packed[symbol] >> 16;
+        codeList[symbol].code = packed[symbol] & 0xffff;
+    }
+}
+
+/// canonical code assignment of Annex C: codes of one length are consecutive,
+/// moving to the next length appends a 0 bit
+void HuffmanCodec::buildCodes(const uint8_t *hufTable, uint32_t codes[256]) {
+    std::memset(codes, 0, sizeof(uint32_t) * 256);
+    int k = 0;
+    uint32_t code = 0;
+    for (int i = 0; i < MAX_HUFFMAN_CODE_LEN; i++) {
+        for (int j = 0; j < hufTable[i]; j++) {
+            const uint8_t symbol = hufTable[MAX_HUFFMAN_CODE_LEN + k];
+            codes[symbol] = (uint32_t(i + 1) << 16) | code;
             code++;
             k++;
         }
         code <<= 1;
     }
-    tabsize = k;
-    for (i = 0; i < tabsize; i++) {
-        symbol = hufTable[MAX_HUFFMAN_CODE_LEN + i];
-        codeList[symbol].depth = hufsize[i];
-        codeList[symbol].code = hufcode[i];
-    }
 }
 
 HuffmanCodec::~HuffmanCodec() {
-    if (mBitStream) {
-        bitstr_flush(mBitStream, 1);
-        bitstr_close(mBitStream);
-    }
     if (mBuffer) {
         free(mBuffer);
     }
 }
 
-bool HuffmanCodec::huffmanEncode(HUFCODEITEM *codeList, int size) {
-    unsigned code;
-    int len;
-    if (!mBitStream) {
-        return false;
-    }
-
-    code = codeList[size].code;
-    len = codeList[size].depth;
-    if (EOF == bitstr_put_bits(mBitStream, code, len)) {
-        return false;
-    }
+///
+/// emit the Huffman code of symbol followed by extraSize extra bits with a single put,
+/// code (<= 16 bits) plus extra bits (<= 11 bits) always fit the 32-bit put
+///
+inline void HuffmanCodec::huffmanEncode(JpegBitWriter &writer, const uint32_t *codes, int symbol, uint32_t extra, int extraSize) {
+    const uint32_t entry = codes[symbol];
+    writer.putBits(((entry & 0xffff) << extraSize) | extra, (entry >> 16) + extraSize);
+}
 
-    return true;
+///
+/// magnitude category (bit length of |code|) and the extra bits of code,
+/// negative values are sent as code - 1 in size bits (one's complement)
+///
+inline void HuffmanCodec::categoryEncode(int &code, int &size) {
+    const int sign = code >> 31; // 0 or -1
+    const uint32_t absc = static_cast<uint32_t>((code ^ sign) - sign);
+    size = magnitudeCategory(absc);
+    code = (code + sign) & ((1 << size) - 1);
 }
 
-void HuffmanCodec::categoryEncode(int &code, int &size) {
-    unsigned absc = abs(code);
-    unsigned mask = (1 << 15);
-    int i = 15;
-    if (absc == 0) {
-        size = 0;
-        return;
-    }
-    while (i && !(absc & mask)) {
-        mask >>= 1;
-        i--;
+#ifdef JPEG_X86_SIMD
+/// 32 coefficients per step: the 16-bit compares are packed to bytes, packs works
+/// per 128-bit half, so the permute restores coefficient order before movemask
+JPEG_TARGET_AVX2
+static uint64_t nonzeroMaskAVX2(const int16_t *const block) {
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t mask = 0;
+    for (int i = 0; i < 2; ++i) {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i * 32));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i * 32 + 16));
+        __m256i eq = _mm256_packs_epi16(_mm256_cmpeq_epi16(v0, zero), _mm256_cmpeq_epi16(v1, zero));
+        eq = _mm256_permute4x64_epi64(eq, 0xD8);
+        mask |= uint64_t(~static_cast<uint32_t>(_mm256_movemask_epi8(eq))) << (i * 32);
     }
-    size = i + 1;
-    if (code < 0) {
-        code = (1 << size) - absc - 1;
+    return mask;
+}
+#endif
+
+///
+/// bit i is set if block[i] != 0
+///
+static uint64_t nonzeroMask(const int16_t *const block) {
+#ifdef JPEG_X86_SIMD
+    if (cpuSupportsAVX2()) return nonzeroMaskAVX2(block);
+#endif
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; ++i) {
+        mask |= uint64_t(block[i] != 0) << i;
     }
+    return mask;
 }
 
-void HuffmanCodec::encodeBlock(const int *const block, int &dc, bool luminance) {
-    void *bs = mBitStream;
+static inline int countTrailingZeros(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    while (!(x & 1)) { x >>= 1; ++n; }
+    return n;
+#endif
+}
+
+void HuffmanCodec::encodeBlock(JpegBitWriter &writer, const int16_t *const block, int &dc,
+                               const uint32_t *dcCodes, const uint32_t *acCodes) const {
     int diff, code, size;
-    RLEITEM rlelist[63];
-    int i, j, n, eob;
 
     // DC 系数的差分脉冲调制编码（DPCM）
     diff = block[0] - dc;
@@ -150,86 +205,411 @@ void HuffmanCodec::encodeBlock(const int *const block, int &dc, bool luminance)
     categoryEncode(code, size);
     // 熵编码 DC
     // huffman encode for dc
-    huffmanEncode(luminance ? mCodeListDCLumin : mCodeListDCChrom, size);
-    bitstr_put_bits(bs, code, size);
-
-    // AC 系数的游程长度编码（RLE）
-    // AC 系数的中间格式计算
-    // rle encode for ac
-    for (i = 1, j = 0, n = 0, eob = 0; i < 64 && j < 63; i++) {
-        if (block[i] == 0 && n < 15) {
-            n++;
-        } else {
-            code = block[i];
-            size = 0;
-            // AC 系数的中间格式计算
-            categoryEncode(code, size);
-            rlelist[j].runlen = n;
-            rlelist[j].codesize = size;
-            rlelist[j].codedata = code;
-            n = 0;
-            j++;
-            if (size != 0) {
-                eob = j;
-            }
+    huffmanEncode(writer, dcCodes, size, code, size);
+
+    // AC 系数的游程长度编码（RLE）: walk the nonzero coefficients only, the zero
+    // run in front of each one is the distance to the previous nonzero index
+    uint64_t mask = nonzeroMask(block) >> 1; // bit i -> AC coefficient i + 1
+    int k = 0; // last coded index
+    while (mask) {
+        int run = countTrailingZeros(mask);
+        mask >>= run + 1;
+        k += run + 1;
+        // ZRL: 16 zeros
+        for (; run >= 16; run -= 16) {
+            huffmanEncode(writer, acCodes, 0xF0, 0, 0);
         }
+        code = block[k];
+        categoryEncode(code, size);
+        huffmanEncode(writer, acCodes, (run << 4) | size, code, size);
     }
-    // 设置 eob
-    if (block[63] == 0) {
-        rlelist[eob].runlen = 0;
-        rlelist[eob].codesize = 0;
-        rlelist[eob].codedata = 0;
-        j = eob + 1;
-    }
-    // 熵编码 AC
-    // huffman encode for ac
-    for (i = 0; i < j; i++) {
-        huffmanEncode(luminance ? mCodeListACLumin : mCodeListACChrom,
-                      (rlelist[i].runlen << 4) | (rlelist[i].codesize << 0));
-        bitstr_put_bits(bs, rlelist[i].codedata, rlelist[i].codesize);
+    // EOB unless the last coefficient was coded
+    if (k != 63) {
+        huffmanEncode(writer, acCodes, 0x00, 0, 0);
     }
 }
 
 inline int div_up(int a, int b) { return (a + b - 1) / b; }
 
-long HuffmanCodec::encode(const int* yBlocks, const int* uBlocks, const int* vBlocks,
+// DC: 16-bit code + 11 extra bits, 63 AC: 16-bit code + 10 extra bits each, doubled for stuffing
+const size_t HuffmanCodec::MAX_BLOCK_BYTES = 2 * (((16 + 11) + 63 * (16 + 10) + 7) / 8);
+
+static int blocksPerMcu(YUVFormat format) {
+    if (format == YUVFormat::YUV444) return 1;
+    if (format == YUVFormat::YUV420) return 4;
+    if (format == YUVFormat::YUV422) return 2;
+    throw std::runtime_error("unsupported YUV format!");
+}
+
+static void mcuGrid(const int w, const int h, YUVFormat format, int &mcu_nw, int &mcu_nh) {
+    const int y_blocks = blocksPerMcu(format);
+    mcu_nw = div_up(w, y_blocks == 1 ? 8 : 16);
+    mcu_nh = div_up(h, y_blocks == 4 ? 16 : 8);
+}
+
+void HuffmanCodec::setRestartInterval(const int mcuRows, const int threads) {
+    mRestartRows = mcuRows > 0 ? mcuRows : 0;
+    mThreads = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+int HuffmanCodec::restartIntervalMcus(const int w, YUVFormat format) const {
+    if (mRestartRows == 0) return 0;
+    int mcu_nw, mcu_nh;
+    mcuGrid(w, 1, format, mcu_nw, mcu_nh);
+    const long mcus = long(mRestartRows) * mcu_nw;
+    if (mcus > 65535) {
+        throw std::runtime_error("restart interval exceeds 65535 MCUs, use fewer MCU rows per interval");
+    }
+    return static_cast<int>(mcus);
+}
+
+void HuffmanCodec::blockCounts(const int w, const int h, YUVFormat format, size_t &lumaBlocks, size_t &chromaBlocks) {
+    int mcu_nw, mcu_nh;
+    mcuGrid(w, h, format, mcu_nw, mcu_nh);
+    chromaBlocks = size_t(mcu_nw) * mcu_nh;
+    lumaBlocks = chromaBlocks * blocksPerMcu(format);
+}
+
+size_t HuffmanCodec::maxScanBytes(const int w, const int h, YUVFormat format, const int restartRows) {
+    int mcu_nw, mcu_nh;
+    mcuGrid(w, h, format, mcu_nw, mcu_nh);
+    const size_t mcus = size_t(mcu_nw) * mcu_nh;
+    const size_t markers = restartRows > 0 ? (mcu_nh - 1) / restartRows : 0;
+    return mcus * (blocksPerMcu(format) + 2) * MAX_BLOCK_BYTES + 2 * markers + WRITER_SLACK_BYTES;
+}
+
+bool HuffmanCodec::encodeToChunks(JpegChunkBuffer &chunks,
+                                  const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                                  const size_t mcus, YUVFormat format) const {
+    const size_t mcuBytes = (blocksPerMcu(format) + 2) * MAX_BLOCK_BYTES + WRITER_SLACK_BYTES;
+    size_t capacity;
+    chunks.clear();
+    uint8_t *chunk = chunks.nextChunk(0, mcuBytes, capacity);
+    JpegBitWriter writer(chunk, capacity);
+    int dcCache[3] = {0, 0, 0};
+    encodeMcusTo(writer, dcCache, yBlocks, uBlocks, vBlocks, mcus, format, &chunks);
+    if (writer.available() < WRITER_SLACK_BYTES) {
+        chunk = chunks.nextChunk(writer.size(), WRITER_SLACK_BYTES, capacity);
+        writer.setBuffer(chunk, capacity);
+    }
+    chunks.finish(writer.flush());
+    return !writer.overflow();
+}
+
+long HuffmanCodec::encode(const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
                           const int w, const int h, YUVFormat format) {
-    if (mBitStream == nullptr) {
-        mBuffer = static_cast<char *>(malloc(w * h * 2));
-        mBitStream = bitstr_open(BITSTR_MEM, mBuffer, reinterpret_cast<char *>(w * h * 2));
-    }
-    int dcCache[3] = {0, 0, 0}; // cache for DPCM 
-
-    if (format == YUVFormat::YUV444) {
-        for(size_t i = 0; i < div_up(w, 8) * div_up(h, 8); ++i) {
-            encodeBlock(yBlocks + i * 64, dcCache[0], true);
-            encodeBlock(uBlocks + i * 64, dcCache[1], false);
-            encodeBlock(vBlocks + i * 64, dcCache[2], false);
-        }
-    } else if(format == YUVFormat::YUV420) {
-        for(size_t i = 0; i < div_up(w, 16) * div_up(h, 16); ++i) {
-            encodeBlock(yBlocks + i * 256,       dcCache[0], true);
-            encodeBlock(yBlocks + i * 256 + 64 , dcCache[0], true);
-            encodeBlock(yBlocks + i * 256 + 128, dcCache[0], true);
-            encodeBlock(yBlocks + i * 256 + 192, dcCache[0], true);
-
-            encodeBlock(uBlocks + i * 64, dcCache[1], false);
-            encodeBlock(vBlocks + i * 64, dcCache[2], false);
-        }
-    } else if(format == YUVFormat::YUV422) {
-        for(size_t i = 0; i < div_up(w, 16) * div_up(h, 8); ++i) {
-            encodeBlock(yBlocks + i * 128,       dcCache[0], true);
-            encodeBlock(yBlocks + i * 128+64,    dcCache[0], true);
-            
-            encodeBlock(uBlocks + i * 64, dcCache[1], false);
-            encodeBlock(vBlocks + i * 64, dcCache[2], false);
-        } 
-    } else {
-        throw std::runtime_error("unsupported YUV format!");
+    int mcu_nw, mcu_nh;
+    mcuGrid(w, h, format, mcu_nw, mcu_nh);
+    const size_t mcus = size_t(mcu_nw) * mcu_nh;
+    mResult.clear();
+    if (mRestartRows == 0) {
+        if (!encodeToChunks(mChunks, yBlocks, uBlocks, vBlocks, mcus, format)) {
+            std::cerr << "HuffmanCodec: output buffer overflow" << std::endl;
+            return -1;
+        }
+        for (size_t i = 0; i < mChunks.chunkCount(); ++i) {
+            mResult.push_back({const_cast<uint8_t*>(mChunks.chunkData(i)), mChunks.chunkSize(i)});
+        }
+        return static_cast<long>(mChunks.size());
+    }
+
+    ///
+    /// restart intervals are independent: each one starts from zero DC predictors
+    /// and ends on a byte boundary, so they are coded into separate buffers
+    /// concurrently and joined with RSTn markers in interval order
+    ///
+    restartIntervalMcus(w, format); // validates the DRI range
+    const int y_stride = blocksPerMcu(format) * 64;
+    const size_t interval = size_t(mRestartRows) * mcu_nw;
+    const size_t segments = (mcus + interval - 1) / interval;
+    if (mSegmentChunks.size() < segments) {
+        mSegmentChunks.resize(segments);
+    }
+    std::vector<char> failed(segments, 0);
+
+    auto worker = [&](const size_t first, const size_t step) {
+        for (size_t s = first; s < segments; s += step) {
+            const size_t begin = s * interval;
+            const size_t count = std::min(interval, mcus - begin);
+            failed[s] = !encodeToChunks(mSegmentChunks[s], yBlocks + begin * y_stride,
+                                        uBlocks + begin * 64, vBlocks + begin * 64, count, format);
+        }
+    };
+    const size_t threads = std::min<size_t>(mThreads, segments);
+    if (threads > 1 && (!mPool || size_t(mPool->size()) < threads - 1)) {
+        mPool.reset(new JpegThreadPool(mThreads - 1));
     }
-    return bitstr_tell(mBitStream);
+    for (size_t t = 1; t < threads; ++t) {
+        mPool->submit([&worker, t, threads](int) { worker(t, threads); });
+    }
+    std::exception_ptr error;
+    try {
+        worker(0, threads);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (threads > 1) mPool->wait(); // the helpers use this frame, even when worker 0 threw
+    if (error) std::rethrow_exception(error);
+
+    static const uint8_t RST_MARKERS[8][2] = {
+        {0xFF, 0xD0}, {0xFF, 0xD1}, {0xFF, 0xD2}, {0xFF, 0xD3},
+        {0xFF, 0xD4}, {0xFF, 0xD5}, {0xFF, 0xD6}, {0xFF, 0xD7}};
+    size_t total = 0;
+    for (size_t s = 0; s < segments; ++s) {
+        if (failed[s]) {
+            std::cerr << "HuffmanCodec: output buffer overflow" << std::endl;
+            mResult.clear();
+            return -1;
+        }
+        if (s > 0) {
+            mResult.push_back({const_cast<uint8_t*>(RST_MARKERS[(s - 1) & 7]), 2});
+            total += 2;
+        }
+        const JpegChunkBuffer &chunks = mSegmentChunks[s];
+        for (size_t i = 0; i < chunks.chunkCount(); ++i) {
+            mResult.push_back({const_cast<uint8_t*>(chunks.chunkData(i)), chunks.chunkSize(i)});
+            total += chunks.chunkSize(i);
+        }
+    }
+    return static_cast<long>(total);
+}
+
+long HuffmanCodec::encodeInto(uint8_t* dst, const size_t capacity,
+                              const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                              const int w, const int h, YUVFormat format) {
+    int mcu_nw, mcu_nh;
+    mcuGrid(w, h, format, mcu_nw, mcu_nh);
+    const size_t mcus = size_t(mcu_nw) * mcu_nh;
+    const size_t interval = mRestartRows > 0 ? size_t(restartIntervalMcus(w, format)) : mcus;
+    const int y_stride = blocksPerMcu(format) * 64;
+    mResult.clear();
+
+    JpegBitWriter writer(dst, capacity);
+    for (size_t begin = 0; begin < mcus; begin += interval) {
+        int dcCache[3] = {0, 0, 0};
+        if (begin > 0) {
+            writer.flush();
+            writer.putMarker(0xD0 + ((begin / interval - 1) & 7));
+        }
+        encodeMcusTo(writer, dcCache, yBlocks + begin * y_stride, uBlocks + begin * 64, vBlocks + begin * 64,
+                     std::min(interval, mcus - begin), format);
+    }
+    const long length = writer.flush();
+    if (writer.overflow()) {
+        std::cerr << "HuffmanCodec: output buffer overflow" << std::endl;
+        return -1;
+    }
+    return length;
+}
+
+///
+/// K.2 of ITU-T T.81 (as in libjpeg's jpeg_gen_optimal_table): repeatedly merge
+/// the two least frequent nodes, then limit code lengths to 16 bits (K.3).
+/// Symbol 256 is reserved with count 1 so that no code consists of all 1-bits.
+///
+void HuffmanCodec::buildOptimalTable(const long freq_in[256], uint8_t *hufTable) {
+    const int MAX_CLEN = 32; // code lengths before limiting
+    int bits[MAX_CLEN + 1] = {0};
+    int codesize[257] = {0};
+    int others[257];
+    long freq[257];
+    for (int i = 0; i < 256; ++i) freq[i] = freq_in[i];
+    freq[256] = 1;
+    std::fill(others, others + 257, -1);
+
+    for (;;) {
+        // c1: least frequency, c2: next least (ties go to the larger symbol)
+        int c1 = -1, c2 = -1;
+        long v = 1000000000L;
+        for (int i = 0; i <= 256; ++i) {
+            if (freq[i] && freq[i] <= v) { v = freq[i]; c1 = i; }
+        }
+        v = 1000000000L;
+        for (int i = 0; i <= 256; ++i) {
+            if (freq[i] && freq[i] <= v && i != c1) { v = freq[i]; c2 = i; }
+        }
+        if (c2 < 0) break;
+
+        freq[c1] += freq[c2];
+        freq[c2] = 0;
+        codesize[c1]++;
+        while (others[c1] >= 0) { c1 = others[c1]; codesize[c1]++; }
+        others[c1] = c2;
+        codesize[c2]++;
+        while (others[c2] >= 0) { c2 = others[c2]; codesize[c2]++; }
+    }
+
+    for (int i = 0; i <= 256; ++i) {
+        if (codesize[i]) {
+            if (codesize[i] > MAX_CLEN) {
+                throw std::runtime_error("Huffman code length overflow");
+            }
+            bits[codesize[i]]++;
+        }
+    }
+    // move the longest codes up the tree, a prefix at length j is split in two
+    for (int i = MAX_CLEN; i > MAX_HUFFMAN_CODE_LEN; i--) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) j--;
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+    // drop the reserved symbol, it holds one of the longest codes
+    int i = MAX_HUFFMAN_CODE_LEN;
+    while (bits[i] == 0) i--;
+    bits[i]--;
+
+    for (int l = 1; l <= MAX_HUFFMAN_CODE_LEN; ++l) hufTable[l - 1] = static_cast<uint8_t>(bits[l]);
+    int p = MAX_HUFFMAN_CODE_LEN;
+    for (int l = 1; l <= MAX_CLEN; ++l) {
+        for (int j = 0; j < 256; ++j) {
+            if (codesize[j] == l) hufTable[p++] = static_cast<uint8_t>(j);
+        }
+    }
+}
+
+/// same symbol walk as encodeBlock, counting instead of emitting
+void HuffmanCodec::countBlock(const int16_t *const block, int &dc, long *dcFreq, long *acFreq) const {
+    int code = block[0] - dc, size;
+    dc = block[0];
+    categoryEncode(code, size);
+    dcFreq[size]++;
+
+    uint64_t mask = nonzeroMask(block) >> 1;
+    int k = 0;
+    while (mask) {
+        int run = countTrailingZeros(mask);
+        mask >>= run + 1;
+        k += run + 1;
+        for (; run >= 16; run -= 16) acFreq[0xF0]++;
+        code = block[k];
+        categoryEncode(code, size);
+        acFreq[(run << 4) | size]++;
+    }
+    if (k != 63) acFreq[0x00]++;
+}
+
+void HuffmanCodec::optimizeTables(const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                                  const int w, const int h, YUVFormat format) {
+    int mcu_nw, mcu_nh;
+    mcuGrid(w, h, format, mcu_nw, mcu_nh);
+    const size_t mcus = size_t(mcu_nw) * mcu_nh;
+    const int y_count = blocksPerMcu(format);
+    const size_t interval = mRestartRows > 0 ? size_t(mRestartRows) * mcu_nw : mcus;
+
+    // [0] luminance, [1] chrominance
+    long dcFreq[2][256] = {{0}}, acFreq[2][256] = {{0}};
+    int dcCache[3] = {0, 0, 0};
+    for (size_t i = 0; i < mcus; ++i) {
+        if (i % interval == 0) {
+            dcCache[0] = dcCache[1] = dcCache[2] = 0;
+        }
+        for (int b = 0; b < y_count; ++b) {
+            countBlock(yBlocks + (i * y_count + b) * 64, dcCache[0], dcFreq[0], acFreq[0]);
+        }
+        countBlock(uBlocks + i * 64, dcCache[1], dcFreq[1], acFreq[1]);
+        countBlock(vBlocks + i * 64, dcCache[2], dcFreq[1], acFreq[1]);
+    }
+
+    mStandardTables = false;
+    buildOptimalTable(dcFreq[0], mHufTables[tableIndex(true, true)]);
+    buildOptimalTable(dcFreq[1], mHufTables[tableIndex(true, false)]);
+    buildOptimalTable(acFreq[0], mHufTables[tableIndex(false, true)]);
+    buildOptimalTable(acFreq[1], mHufTables[tableIndex(false, false)]);
+    initCodeList(true, true);
+    initCodeList(true, false);
+    initCodeList(false, true);
+    initCodeList(false, false);
+}
+
+void HuffmanCodec::beginScan(const size_t capacity) {
+    mResult.clear();
+    if (mBufferSize < capacity) {
+        free(mBuffer);
+        mBuffer = static_cast<char *>(malloc(capacity));
+        mBufferSize = capacity;
+    }
+    mWriter.reset(reinterpret_cast<uint8_t*>(mBuffer), mBufferSize);
+    mDcCache[0] = mDcCache[1] = mDcCache[2] = 0;
+}
+
+long HuffmanCodec::encodeMcus(const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                              const size_t mcus, YUVFormat format) {
+    encodeMcusTo(mWriter, mDcCache, yBlocks, uBlocks, vBlocks, mcus, format);
+    return mWriter.overflow() ? -1 : static_cast<long>(mWriter.size());
+}
+
+void HuffmanCodec::encodeMcusTo(JpegBitWriter &writer, int dcCache[3],
+                                const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                                const size_t mcus, YUVFormat format,
+                                JpegChunkBuffer *chunks) const {
+    const uint32_t *dcY = mDCCodes[0], *acY = mACCodes[0];
+    const uint32_t *dcC = mDCCodes[1], *acC = mACCodes[1];
+    const int y_count = blocksPerMcu(format);
+    const size_t mcuBytes = (y_count + 2) * MAX_BLOCK_BYTES + WRITER_SLACK_BYTES;
+
+    for (size_t i = 0; i < mcus; ++i) {
+        if (chunks && writer.available() < mcuBytes) {
+            size_t capacity;
+            uint8_t *chunk = chunks->nextChunk(writer.size(), mcuBytes, capacity);
+            writer.setBuffer(chunk, capacity);
+        }
+        const int16_t *y = yBlocks + i * y_count * 64;
+        for (int b = 0; b < y_count; ++b) {
+            encodeBlock(writer, y + b * 64, dcCache[0], dcY, acY);
+        }
+        encodeBlock(writer, uBlocks + i * 64, dcCache[1], dcC, acC);
+        encodeBlock(writer, vBlocks + i * 64, dcCache[2], dcC, acC);
+    }
+}
+
+void HuffmanCodec::rewind() {
+    mWriter.rewind();
+}
+
+void HuffmanCodec::writeRestart(const int index) {
+    mWriter.flush();
+    mWriter.putMarker(0xD0 + (index & 7));
+    mDcCache[0] = mDcCache[1] = mDcCache[2] = 0;
+}
+
+long HuffmanCodec::finishScan() {
+    long length = mWriter.flush();
+    if (mWriter.overflow()) {
+        std::cerr << "HuffmanCodec: output buffer overflow, encoded data is truncated" << std::endl;
+        return -1;
+    }
+    return length;
+}
+
+size_t HuffmanCodec::resultSize() const {
+    size_t total = 0;
+    for (auto &piece : mResult) total += piece.iov_len;
+    return total;
 }
 
 char* HuffmanCodec::getResult() {
+    if (mResult.size() == 1) {
+        return static_cast<char *>(mResult[0].iov_base);
+    }
+    if (mResult.size() > 1) {
+        // join the chunks once, later calls find a single piece
+        const size_t total = resultSize();
+        if (mBufferSize < total) {
+            free(mBuffer);
+            mBuffer = static_cast<char *>(malloc(total));
+            mBufferSize = total;
+        }
+        char *dst = mBuffer;
+        for (auto &piece : mResult) {
+            std::memcpy(dst, piece.iov_base, piece.iov_len);
+            dst += piece.iov_len;
+        }
+        mResult.assign(1, {mBuffer, total});
+    }
     return mBuffer;
 }
@@ -0,0 +1,317 @@
+#include "JpegBatch.hpp"
+#include "JpegEncoder.hpp"
+#include "JpegSink.hpp"
+#include "JpegThreadPool.hpp"
+#include "JpegQueue.hpp"
+#include "HuffmanCodec.hpp"
+#include "image.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <dirent.h>
+
+JpegBatch::JpegBatch(const int threads): mThreads(threads), mRestartRows(0), mOptimizeHuffman(false),
+                                         mProgressive(false), mPipeline(false) {
+}
+
+JpegBatchStats JpegBatch::run(const std::vector<JpegJob> &jobs) {
+    return mPipeline && !mProgressive ? runPipeline(jobs) : runTasks(jobs);
+}
+
+JpegBatchStats JpegBatch::runTasks(const std::vector<JpegJob> &jobs) {
+    const auto start = std::chrono::steady_clock::now();
+    JpegThreadPool pool(mThreads);
+
+    // per worker: encoder context and statistics, so workers never share state
+    std::vector<std::unique_ptr<JpegEncoder>> encoders(pool.size());
+    std::vector<JpegBatchStats> stats(pool.size(), JpegBatchStats{0, 0, 0, 0, 0.0});
+    for (auto &encoder : encoders) {
+        encoder.reset(new JpegEncoder());
+        encoder->setRestartInterval(mRestartRows);
+        encoder->setOptimizeHuffman(mOptimizeHuffman);
+        encoder->setProgressive(mProgressive);
+        encoder->setVerbose(false);
+    }
+    std::mutex reportMutex;
+
+    for (const JpegJob &job : jobs) {
+        pool.submit([&, job](int worker) {
+            JpegBatchStats &stat = stats[worker];
+            try {
+                StbImage decoded(job.input.c_str());
+                ImageView<uint8_t> rgb = decoded.view();
+
+                FdSink sink(job.output.c_str());
+                if (!sink.isOpen()) {
+                    throw std::runtime_error(sink.error());
+                }
+                encoders[worker]->encodeRGB(rgb, job.quality, job.format, sink);
+                if (!sink.close()) {
+                    throw std::runtime_error(sink.error());
+                }
+                stat.images++;
+                stat.pixels += uint64_t(rgb.cols()) * rgb.rows();
+                stat.outputBytes += sink.bytesWritten();
+            } catch (const std::exception &ex) {
+                stat.failed++;
+                std::lock_guard<std::mutex> lock(reportMutex);
+                std::cerr << "Error: " << job.input << ": " << ex.what() << std::endl;
+            }
+        });
+    }
+    pool.wait();
+
+    JpegBatchStats total{0, 0, 0, 0, 0.0};
+    for (const auto &stat : stats) {
+        total.images += stat.images;
+        total.failed += stat.failed;
+        total.pixels += stat.pixels;
+        total.outputBytes += stat.outputBytes;
+    }
+    total.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return total;
+}
+
+namespace {
+/// an image on its way through the pipeline
+struct PipelineItem {
+    const JpegJob* job;
+    StbImage pixels;
+    JpegCoefficients coefficients;
+    std::unique_ptr<HuffmanCodec> codec;
+};
+typedef std::unique_ptr<PipelineItem> PipelineItemPtr;
+}
+
+JpegBatchStats JpegBatch::runPipeline(const std::vector<JpegJob> &jobs) {
+    const auto start = std::chrono::steady_clock::now();
+    const int threads = mThreads > 0 ? mThreads : std::max(1u, std::thread::hardware_concurrency());
+    // pixel work dominates, decode and entropy coding get about a quarter each
+    const int decoders = std::max(1, threads / 4);
+    const int transformers = std::max(1, threads / 2);
+    const int coders = std::max(1, threads / 4);
+
+    // every queue holds at most two items per consumer thread
+    JpegQueue<PipelineItemPtr> decoded(2 * transformers);
+    JpegQueue<PipelineItemPtr> transformed(2 * coders);
+    JpegQueue<PipelineItemPtr> coded(2);
+    // entropy coders hold their scan until it is written, so they cycle through a
+    // fixed set that is handed back by the writer
+    const size_t codecCount = coders + coded.capacity() + 1;
+    JpegQueue<std::unique_ptr<HuffmanCodec>> freeCodecs(codecCount);
+    for (size_t i = 0; i < codecCount; ++i) {
+        std::unique_ptr<HuffmanCodec> codec(new HuffmanCodec());
+        freeCodecs.push(std::move(codec));
+    }
+
+    std::mutex reportMutex;
+    std::atomic<size_t> failed(0);
+    auto fail = [&](const PipelineItemPtr &item, const char* what) {
+        failed++;
+        if (item->codec) freeCodecs.push(std::move(item->codec));
+        std::lock_guard<std::mutex> lock(reportMutex);
+        std::cerr << "Error: " << item->job->input << ": " << what << std::endl;
+    };
+    auto encoder = [this]() {
+        std::unique_ptr<JpegEncoder> encoder(new JpegEncoder());
+        encoder->setRestartInterval(mRestartRows);
+        encoder->setOptimizeHuffman(mOptimizeHuffman);
+        encoder->setVerbose(false);
+        return encoder;
+    };
+
+    std::atomic<size_t> nextJob(0);
+    std::atomic<int> decodersLeft(decoders), transformersLeft(transformers), codersLeft(coders);
+    std::vector<std::thread> stages;
+
+    for (int t = 0; t < decoders; ++t) {
+        stages.emplace_back([&]() {
+            for (size_t i; (i = nextJob++) < jobs.size(); ) {
+                PipelineItemPtr item(new PipelineItem());
+                item->job = &jobs[i];
+                try {
+                    item->pixels = StbImage(jobs[i].input.c_str());
+                } catch (const std::exception &ex) {
+                    fail(item, ex.what());
+                    continue;
+                }
+                decoded.push(std::move(item));
+            }
+            if (--decodersLeft == 0) decoded.close();
+        });
+    }
+    for (int t = 0; t < transformers; ++t) {
+        stages.emplace_back([&]() {
+            std::unique_ptr<JpegEncoder> context = encoder();
+            PipelineItemPtr item;
+            while (decoded.pop(item)) {
+                try {
+                    context->transformRGB(item->pixels.view(), item->job->quality, item->job->format, item->coefficients);
+                    item->pixels = StbImage(); // the pixels are no longer needed
+                } catch (const std::exception &ex) {
+                    fail(item, ex.what());
+                    continue;
+                }
+                transformed.push(std::move(item));
+            }
+            if (--transformersLeft == 0) transformed.close();
+        });
+    }
+    for (int t = 0; t < coders; ++t) {
+        stages.emplace_back([&]() {
+            std::unique_ptr<JpegEncoder> context = encoder();
+            PipelineItemPtr item;
+            while (transformed.pop(item)) {
+                freeCodecs.pop(item->codec);
+                try {
+                    if (context->entropyCode(item->coefficients, *item->codec) <= 0) {
+                        throw std::runtime_error("entropy coding failed");
+                    }
+                    // keep what the header needs, drop the coefficients
+                    AlignedVector<int16_t>().swap(item->coefficients.y);
+                    AlignedVector<int16_t>().swap(item->coefficients.u);
+                    AlignedVector<int16_t>().swap(item->coefficients.v);
+                } catch (const std::exception &ex) {
+                    fail(item, ex.what());
+                    continue;
+                }
+                coded.push(std::move(item));
+            }
+            if (--codersLeft == 0) coded.close();
+        });
+    }
+
+    // the calling thread writes
+    JpegBatchStats total{0, 0, 0, 0, 0.0};
+    PipelineItemPtr item;
+    while (coded.pop(item)) {
+        try {
+            FdSink sink(item->job->output.c_str());
+            if (!sink.isOpen()) {
+                throw std::runtime_error(sink.error());
+            }
+            JpegEncoder::writeJpeg(item->coefficients, *item->codec, sink);
+            if (!sink.close()) {
+                throw std::runtime_error(sink.error());
+            }
+            total.images++;
+            total.pixels += uint64_t(item->coefficients.width) * item->coefficients.height;
+            total.outputBytes += sink.bytesWritten();
+            freeCodecs.push(std::move(item->codec));
+        } catch (const std::exception &ex) {
+            fail(item, ex.what());
+        }
+    }
+    for (auto &stage : stages) stage.join();
+
+    total.failed = failed;
+    total.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return total;
+}
+
+YUVFormat JpegBatch::parseFormat(const std::string &format) {
+    if (format == "444") return YUVFormat::YUV444;
+    if (format == "420") return YUVFormat::YUV420;
+    if (format == "422") return YUVFormat::YUV422;
+    throw std::runtime_error("Invalid value for format: " + format);
+}
+
+std::string JpegBatch::defaultOutput(const std::string &input, const std::string &outputDir) {
+    std::string name = input.substr(input.find_last_of('/') + 1);
+    const size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) {
+        name = name.substr(0, dot);
+    }
+    if (outputDir.empty()) {
+        return name + ".jpg";
+    }
+    return outputDir + (outputDir.back() == '/' ? "" : "/") + name + ".jpg";
+}
+
+std::vector<JpegJob> JpegBatch::fromInputs(const std::vector<std::string> &inputs,
+                                           const std::string &outputDir,
+                                           const int quality, YUVFormat format) {
+    std::vector<JpegJob> jobs;
+    for (const auto &input : inputs) {
+        jobs.push_back(JpegJob{input, defaultOutput(input, outputDir), quality, format});
+    }
+    return jobs;
+}
+
+static bool isImageFile(const std::string &name) {
+    static const char* extensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".tga", ".ppm",
+                                       ".pgm", ".pnm", ".gif", ".psd", ".hdr", ".pic"};
+    const size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos) return false;
+    std::string ext = name.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    for (const char* e : extensions) {
+        if (ext == e) return true;
+    }
+    return false;
+}
+
+std::vector<JpegJob> JpegBatch::fromDirectory(const std::string &dir,
+                                              const std::string &outputDir,
+                                              const int quality, YUVFormat format) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        throw std::runtime_error("cannot open directory: " + dir);
+    }
+    std::vector<std::string> inputs;
+    while (struct dirent* entry = readdir(d)) {
+        const std::string name = entry->d_name;
+        if (name[0] != '.' && isImageFile(name)) {
+            inputs.push_back(dir + (dir.back() == '/' ? "" : "/") + name);
+        }
+    }
+    closedir(d);
+    std::sort(inputs.begin(), inputs.end());
+    return fromInputs(inputs, outputDir, quality, format);
+}
+
+std::vector<JpegJob> JpegBatch::fromManifest(const std::string &path,
+                                             const std::string &outputDir,
+                                             const int quality, YUVFormat format) {
+    std::ifstream manifest(path);
+    if (!manifest) {
+        throw std::runtime_error("cannot open manifest: " + path);
+    }
+    std::vector<JpegJob> jobs;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(manifest, line)) {
+        lineNumber++;
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos) line.resize(comment);
+        std::istringstream fields(line);
+        std::string input, output, q, f, extra;
+        if (!(fields >> input)) continue; // blank line
+        fields >> output >> q >> f;
+        if (fields >> extra) {
+            throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": too many fields");
+        }
+
+        JpegJob job{input, defaultOutput(input, outputDir), quality, format};
+        if (!output.empty() && output != "-") job.output = output;
+        if (!q.empty() && q != "-") {
+            try {
+                job.quality = std::stoi(q);
+            } catch (...) {
+                throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": invalid quality " + q);
+            }
+        }
+        if (!f.empty() && f != "-") job.format = parseFormat(f);
+        jobs.push_back(job);
+    }
+    return jobs;
+}
@@ -1,7 +1,13 @@
 #include "JpegColor.hpp"
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <stdexcept>
 
+#ifdef JPEG_X86_SIMD
+#include <immintrin.h>
+#endif
+
 
 template <typename T>
 inline T bound(T min, T value, T max) {
@@ -13,62 +19,231 @@ inline int div_up(int a, int b) {
 }
 
 
+///
+/// fixed-point BT.601 coefficients (JFIF full range) scaled by 2^14 so that every
+/// product fits the 16-bit multiply-add of the SIMD path
+///
+namespace {
+const int CSC_SHIFT = 14;
+const int CSC_Y_R = 4899, CSC_Y_G = 9617, CSC_Y_B = 1868;
+const int CSC_CB_R = -2765, CSC_CB_G = -5427, CSC_CB_B = 8192;
+const int CSC_CR_R = 8192, CSC_CR_G = -6860, CSC_CR_B = -1332;
+const int CSC_Y_BIAS = 1 << (CSC_SHIFT - 1);
+// chroma rounds with (half - 1) as in libjpeg, which keeps Cb/Cr within [0, 255] without clamping
+const int CSC_C_BIAS = (128 << CSC_SHIFT) + (1 << (CSC_SHIFT - 1)) - 1;
+
+#ifdef JPEG_X86_SIMD
+/// two signed 16-bit coefficients as one madd lane pair, lo in the low half; built
+/// on unsigned values since shifting a negative int is undefined
+constexpr int packPair(const int lo, const int hi) {
+    return int((uint32_t(hi) << 16) | (uint32_t(lo) & 0xffff));
+}
+
+///
+/// one 8-pixel group is loaded as two overlapping 16-byte chunks, shuffled into
+/// (R, G) and (B, 0) 16-bit pairs, then reduced with madd into 32-bit sums
+///
+JPEG_TARGET_AVX2
+inline void convert8AVX2(const uint8_t* p, __m256i &vy, __m256i &vcb, __m256i &vcr) {
+    const __m256i shuf_rg = _mm256_setr_epi8(
+            0, -1, 1, -1, 3, -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1,
+            4, -1, 5, -1, 7, -1, 8, -1, 10, -1, 11, -1, 13, -1, 14, -1);
+    const __m256i shuf_b = _mm256_setr_epi8(
+            2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1,
+            6, -1, -1, -1, 9, -1, -1, -1, 12, -1, -1, -1, 15, -1, -1, -1);
+    const __m256i y_rg  = _mm256_set1_epi32(packPair(CSC_Y_R,  CSC_Y_G));
+    const __m256i cb_rg = _mm256_set1_epi32(packPair(CSC_CB_R, CSC_CB_G));
+    const __m256i cr_rg = _mm256_set1_epi32(packPair(CSC_CR_R, CSC_CR_G));
+    const __m256i y_b  = _mm256_set1_epi32(CSC_Y_B  & 0xffff);
+    const __m256i cb_b = _mm256_set1_epi32(CSC_CB_B & 0xffff);
+    const __m256i cr_b = _mm256_set1_epi32(CSC_CR_B & 0xffff);
+    const __m256i y_bias = _mm256_set1_epi32(CSC_Y_BIAS);
+    const __m256i c_bias = _mm256_set1_epi32(CSC_C_BIAS);
+
+    __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8)), 1);
+    __m256i rg = _mm256_shuffle_epi8(v, shuf_rg);
+    __m256i b = _mm256_shuffle_epi8(v, shuf_b);
+    vy  = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(rg, y_rg),  _mm256_madd_epi16(b, y_b)),  y_bias);
+    vcb = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(rg, cb_rg), _mm256_madd_epi16(b, cb_b)), c_bias);
+    vcr = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(rg, cr_rg), _mm256_madd_epi16(b, cr_b)), c_bias);
+}
+
+/// descale two 8-lane sums and store them as 16 consecutive bytes
+JPEG_TARGET_AVX2
+inline void store16AVX2(uint8_t* dst, __m256i lo, __m256i hi) {
+    __m256i w = _mm256_packs_epi32(_mm256_srai_epi32(lo, CSC_SHIFT), _mm256_srai_epi32(hi, CSC_SHIFT));
+    w = _mm256_permute4x64_epi64(w, 0xD8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                     _mm_packus_epi16(_mm256_castsi256_si128(w), _mm256_extracti128_si256(w, 1)));
+}
+
+/// 16 pixels per iteration, returns the number of pixels converted
+JPEG_TARGET_AVX2
+int rgbRowToYCbCrAVX2(const uint8_t* rgb, uint8_t* y, uint8_t* cb, uint8_t* cr, const int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i y0, cb0, cr0, y1, cb1, cr1;
+        convert8AVX2(rgb + 3 * i, y0, cb0, cr0);
+        convert8AVX2(rgb + 3 * i + 24, y1, cb1, cr1);
+        store16AVX2(y + i, y0, y1);
+        store16AVX2(cb + i, cb0, cb1);
+        store16AVX2(cr + i, cr0, cr1);
+    }
+    return i;
+}
+#endif
+} // namespace
+
+void JpegColor::rgbRowToYCbCrScalar(const uint8_t* rgb, uint8_t* y, uint8_t* cb, uint8_t* cr, const int n) {
+    for (int i = 0; i < n; ++i, rgb += 3) {
+        const int r = rgb[0], g = rgb[1], b = rgb[2];
+        y[i]  = static_cast<uint8_t>((CSC_Y_R  * r + CSC_Y_G  * g + CSC_Y_B  * b + CSC_Y_BIAS) >> CSC_SHIFT);
+        cb[i] = static_cast<uint8_t>((CSC_CB_R * r + CSC_CB_G * g + CSC_CB_B * b + CSC_C_BIAS) >> CSC_SHIFT);
+        cr[i] = static_cast<uint8_t>((CSC_CR_R * r + CSC_CR_G * g + CSC_CR_B * b + CSC_C_BIAS) >> CSC_SHIFT);
+    }
+}
+
+void JpegColor::rgbRowToYCbCr(const uint8_t* rgb, uint8_t* y, uint8_t* cb, uint8_t* cr, const int n) {
+    int done = 0;
+#ifdef JPEG_X86_SIMD
+    if (cpuSupportsAVX2()) {
+        done = rgbRowToYCbCrAVX2(rgb, y, cb, cr, n);
+    }
+#endif
+    rgbRowToYCbCrScalar(rgb + 3 * done, y + done, cb + done, cr + done, n - done);
+}
+
 ///
 /// convert RGB image to YUV format, YUV444 means that there is no sub-sampling for U,V channels
 ///
-Image<uint8_t> JpegColor::rgbToYUV444(const Image<uint8_t> &rgb) {
+Image<uint8_t> JpegColor::rgbToYUV444(const ImageView<uint8_t> &rgb) {
     if (rgb.channels() != 3) {
         throw std::runtime_error(" input image's channels != 3 "); 
     }
 
-    Image<uint8_t> yuv(rgb);
-    /* TODO: implement color transform here : RGB -> YUV ,
-     * Image class (see include/image.hpp) API ref.:  
-     *  - rows(), cols(), channels()  
-     *  - rgb.(y, x, c) -> return pixel at (y, x, c)
-     */
-
-    throw std::runtime_error("TODO: rgbToYUV444 was not implemented!"); // delete this line when you implement the conversion
-
+    const int w = rgb.cols();
+    const int h = rgb.rows();
+    Image<uint8_t> yuv(h, w, 3);
+    std::vector<uint8_t> planes(3 * w);
+    uint8_t* py = planes.data();
+    uint8_t* pu = py + w;
+    uint8_t* pv = pu + w;
+    for (int y = 0; y < h; ++y) {
+        rgbRowToYCbCr(rgb.row(y), py, pu, pv, w);
+        uint8_t* dst = yuv.data() + size_t(y) * w * 3;
+        for (int x = 0; x < w; ++x, dst += 3) {
+            dst[0] = py[x]; dst[1] = pu[x]; dst[2] = pv[x];
+        }
+    }
     return yuv;
 }
 
 ///
-/// sample blocks from a given YUV image
+/// fused color stage: a macroblock row of RGB is converted once into planar Y/Cb/Cr
+/// rows (edge pixels replicated up to the macroblock grid), the chroma rows are
+/// averaged down by sx * sy in place, and the 8x8 blocks are then plain row copies
 ///
-void JpegColor::sampleToBlocks(const Image<uint8_t> &image, 
-                               std::vector<uint8_t> &y_blocks, 
-                               std::vector<uint8_t> &u_blocks, 
-                               std::vector<uint8_t> &v_blocks, 
-                               const int block_w, const int block_h, 
-                               const int sx, const int sy 
-                               ) {
-    const int w = image.cols();
-    const int h = image.rows();
-    int block_nw = div_up(w, block_w); // make sure cover all pixels
-    int block_nh = div_up(h, block_h);
-
-    // sx, sy are sampling factors from horizontal and vertical directions, e.g., for YUV420, the macroblock size will be 16*16,
-    // there will be four sequential 8*8 blocks for Y channel; for U, V channel, a macroblock (16*16) will be 
-    // down-sampled to a 8*8 block. In this case, sx=2, sy=2, block_w=block_h=16, 
-    // block_stride = 64 refers to the size of a 8*8 block, since we flatten blocks into a one-dimensional vector. 
-    // here N = block_nw * block_nh is the total number of macroblocks (16*16), 
-    // y_blocks will have N * sx * sy blocks (8*8), u_blocks/v_blocks will have N blocks (8*8), 
-    // thus, given a macroblock with shape of 16*16, it should output four sequential 8*8 blocks (from left to right, from top to bottom) for Y channel,
-    // one 8*8 block for U channel, one 8*8 block for V channel.
-    // here we store blocks in y_blocks, u_blocks, v_blocks respectively as they will be processed indivisually.
-    // 
-    size_t block_stride = int(block_h / sy) * int(block_w / sx); 
-    y_blocks.resize(block_stride * block_nw * block_nh * sx * sy);
-    u_blocks.resize(block_stride * block_nw * block_nh );
-    v_blocks.resize(block_stride * block_nw * block_nh );
-
-    for (size_t by = 0; by < block_nh; ++by) {
-         for(size_t bx = 0; bx < block_nw; ++bx) {
-             size_t block_id = bx + by * block_nw; 
-             // scan each block of ROI, from left to right, from top to bottom
-             /* TODO: implement here */
-             throw std::runtime_error("TODO: sampleToBlocks was not implemented!"); 
-         }
+void JpegColor::mcuRowToBlocks(const ImageView<uint8_t> &rgb, const int mb_row,
+                               uint8_t* y_blocks, uint8_t* u_blocks, uint8_t* v_blocks,
+                               const int block_w, const int block_h,
+                               const int sx, const int sy,
+                               std::vector<uint8_t> &scratch) {
+    if (rgb.channels() != 3) {
+        throw std::runtime_error(" input image's channels != 3 ");
+    }
+    ASSERT(block_w == 8 * sx && block_h == 8 * sy, "macroblock must be (8*sx) x (8*sy) !");
+    const int w = rgb.cols();
+    const int h = rgb.rows();
+    const int block_nw = div_up(w, block_w);
+    const int pw = block_nw * block_w; // padded plane width
+    const size_t plane = size_t(pw) * block_h;
+    if (scratch.size() < 3 * plane) scratch.resize(3 * plane);
+    uint8_t* py = scratch.data();
+    uint8_t* pu = py + plane;
+    uint8_t* pv = pu + plane;
+
+    for (int r = 0; r < block_h; ++r) {
+        const int src_y = std::min(mb_row * block_h + r, h - 1);
+        uint8_t* ry = py + size_t(r) * pw;
+        uint8_t* ru = pu + size_t(r) * pw;
+        uint8_t* rv = pv + size_t(r) * pw;
+        rgbRowToYCbCr(rgb.row(src_y), ry, ru, rv, w);
+        std::fill(ry + w, ry + pw, ry[w - 1]);
+        std::fill(ru + w, ru + pw, ru[w - 1]);
+        std::fill(rv + w, rv + pw, rv[w - 1]);
+    }
+
+    // chroma subsampling, the result (pw / sx) x 8 overwrites the head of each plane
+    if (sx > 1 || sy > 1) {
+        const int cw = pw / sx;
+        const int area = sx * sy;
+        for (uint8_t* p : {pu, pv}) {
+            for (int r = 0; r < 8; ++r) {
+                uint8_t* dst = p + size_t(r) * cw;
+                for (int x = 0; x < cw; ++x) {
+                    int sum = 0;
+                    for (int j = 0; j < sy; ++j) {
+                        const uint8_t* src = p + size_t(r * sy + j) * pw + x * sx;
+                        for (int i = 0; i < sx; ++i) sum += src[i];
+                    }
+                    dst[x] = static_cast<uint8_t>((sum + area / 2) / area);
+                }
+            }
+        }
+    }
+
+    const int cw = pw / sx;
+    for (int bx = 0; bx < block_nw; ++bx) {
+        uint8_t* yb = y_blocks + size_t(bx) * sx * sy * 64;
+        for (int j = 0; j < sy; ++j) {
+            for (int i = 0; i < sx; ++i, yb += 64) {
+                const uint8_t* src = py + size_t(j * 8) * pw + bx * block_w + i * 8;
+                for (int r = 0; r < 8; ++r) std::memcpy(yb + r * 8, src + size_t(r) * pw, 8);
+            }
+        }
+        uint8_t* ub = u_blocks + size_t(bx) * 64;
+        uint8_t* vb = v_blocks + size_t(bx) * 64;
+        for (int r = 0; r < 8; ++r) {
+            std::memcpy(ub + r * 8, pu + size_t(r) * cw + bx * 8, 8);
+            std::memcpy(vb + r * 8, pv + size_t(r) * cw + bx * 8, 8);
+        }
+    }
+}
+
+size_t JpegColor::blockCount(const int w, const int h, const int block_w, const int block_h) {
+    return size_t(div_up(w, block_w)) * div_up(h, block_h);
+}
+
+void JpegColor::rgbToBlocks(const ImageView<uint8_t> &rgb,
+                            std::vector<uint8_t> &y_blocks,
+                            std::vector<uint8_t> &u_blocks,
+                            std::vector<uint8_t> &v_blocks,
+                            const int block_w, const int block_h,
+                            const int sx, const int sy) {
+    const size_t blocks = blockCount(rgb.cols(), rgb.rows(), block_w, block_h);
+    y_blocks.resize(64 * blocks * sx * sy);
+    u_blocks.resize(64 * blocks);
+    v_blocks.resize(64 * blocks);
+
+    std::vector<uint8_t> scratch;
+    rgbToBlocks(rgb, y_blocks.data(), u_blocks.data(), v_blocks.data(), block_w, block_h, sx, sy, scratch);
+}
+
+void JpegColor::rgbToBlocks(const ImageView<uint8_t> &rgb,
+                            uint8_t* y_blocks, uint8_t* u_blocks, uint8_t* v_blocks,
+                            const int block_w, const int block_h,
+                            const int sx, const int sy,
+                            std::vector<uint8_t> &scratch) {
+    const int block_nw = div_up(rgb.cols(), block_w);
+    const int block_nh = div_up(rgb.rows(), block_h);
+    for (int by = 0; by < block_nh; ++by) {
+        const size_t mb = size_t(by) * block_nw;
+        mcuRowToBlocks(rgb, by,
+                       y_blocks + mb * sx * sy * 64,
+                       u_blocks + mb * 64,
+                       v_blocks + mb * 64,
+                       block_w, block_h, sx, sy, scratch);
     }
 }
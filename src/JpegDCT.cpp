@@ -0,0 +1,227 @@
+/// ref. : https://github.com/libjpeg-turbo/libjpeg-turbo/blob/main/jfdctint.c
+
+#include "JpegDCT.hpp"
+#include "common.hpp"
+
+#ifdef JPEG_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+const int CONST_BITS = 13;
+const int PASS1_BITS = 2;
+// libjpeg's islow output is scaled up by 8, we remove it in the second pass
+const int OUT_BITS = 3;
+
+const int FIX_0_298631336 = 2446;
+const int FIX_0_390180644 = 3196;
+const int FIX_0_541196100 = 4433;
+const int FIX_0_765366865 = 6270;
+const int FIX_0_899976223 = 7373;
+const int FIX_1_175875602 = 9633;
+const int FIX_1_501321110 = 12299;
+const int FIX_1_847759065 = 15137;
+const int FIX_1_961570560 = 16069;
+const int FIX_2_053119869 = 16819;
+const int FIX_2_562915447 = 20995;
+const int FIX_3_072711026 = 25172;
+
+inline int descale(int x, int n) { return (x + (1 << (n - 1))) >> n; }
+
+///
+/// 1-D transform of 8 samples; in pass 1 the even outputs 0/4 are scaled up by
+/// PASS1_BITS, in pass 2 they are descaled by shift_dc, all other outputs are
+/// descaled by shift
+///
+inline void fdct1d(const int d[8], int out[8], const int shift, const int shift_dc, const bool pass1) {
+    int tmp0 = d[0] + d[7], tmp7 = d[0] - d[7];
+    int tmp1 = d[1] + d[6], tmp6 = d[1] - d[6];
+    int tmp2 = d[2] + d[5], tmp5 = d[2] - d[5];
+    int tmp3 = d[3] + d[4], tmp4 = d[3] - d[4];
+
+    // even part
+    int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+    int tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+    if (pass1) {
+        out[0] = (tmp10 + tmp11) * (1 << PASS1_BITS);
+        out[4] = (tmp10 - tmp11) * (1 << PASS1_BITS);
+    } else {
+        out[0] = descale(tmp10 + tmp11, shift_dc);
+        out[4] = descale(tmp10 - tmp11, shift_dc);
+    }
+    int z1 = (tmp12 + tmp13) * FIX_0_541196100;
+    out[2] = descale(z1 + tmp13 * FIX_0_765366865, shift);
+    out[6] = descale(z1 - tmp12 * FIX_1_847759065, shift);
+
+    // odd part
+    z1 = tmp4 + tmp7;
+    int z2 = tmp5 + tmp6;
+    int z3 = tmp4 + tmp6;
+    int z4 = tmp5 + tmp7;
+    int z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp4 *= FIX_0_298631336;
+    tmp5 *= FIX_2_053119869;
+    tmp6 *= FIX_3_072711026;
+    tmp7 *= FIX_1_501321110;
+    z1 *= -FIX_0_899976223;
+    z2 *= -FIX_2_562915447;
+    z3 = z3 * -FIX_1_961570560 + z5;
+    z4 = z4 * -FIX_0_390180644 + z5;
+
+    out[7] = descale(tmp4 + z1 + z3, shift);
+    out[5] = descale(tmp5 + z2 + z4, shift);
+    out[3] = descale(tmp6 + z2 + z3, shift);
+    out[1] = descale(tmp7 + z1 + z4, shift);
+}
+
+#ifdef JPEG_X86_SIMD
+JPEG_TARGET_AVX2
+inline __m256i mulc(__m256i x, int c) { return _mm256_mullo_epi32(x, _mm256_set1_epi32(c)); }
+
+JPEG_TARGET_AVX2
+inline __m256i descale(__m256i x, int n) {
+    return _mm256_srai_epi32(_mm256_add_epi32(x, _mm256_set1_epi32(1 << (n - 1))), n);
+}
+
+/// same arithmetic as the scalar fdct1d on 8 independent lanes
+JPEG_TARGET_AVX2
+inline void fdct1d(const __m256i d[8], __m256i out[8], const int shift, const int shift_dc, const bool pass1) {
+    __m256i tmp0 = _mm256_add_epi32(d[0], d[7]), tmp7 = _mm256_sub_epi32(d[0], d[7]);
+    __m256i tmp1 = _mm256_add_epi32(d[1], d[6]), tmp6 = _mm256_sub_epi32(d[1], d[6]);
+    __m256i tmp2 = _mm256_add_epi32(d[2], d[5]), tmp5 = _mm256_sub_epi32(d[2], d[5]);
+    __m256i tmp3 = _mm256_add_epi32(d[3], d[4]), tmp4 = _mm256_sub_epi32(d[3], d[4]);
+
+    // even part
+    __m256i tmp10 = _mm256_add_epi32(tmp0, tmp3), tmp13 = _mm256_sub_epi32(tmp0, tmp3);
+    __m256i tmp11 = _mm256_add_epi32(tmp1, tmp2), tmp12 = _mm256_sub_epi32(tmp1, tmp2);
+    if (pass1) {
+        out[0] = _mm256_slli_epi32(_mm256_add_epi32(tmp10, tmp11), PASS1_BITS);
+        out[4] = _mm256_slli_epi32(_mm256_sub_epi32(tmp10, tmp11), PASS1_BITS);
+    } else {
+        out[0] = descale(_mm256_add_epi32(tmp10, tmp11), shift_dc);
+        out[4] = descale(_mm256_sub_epi32(tmp10, tmp11), shift_dc);
+    }
+    __m256i z1 = mulc(_mm256_add_epi32(tmp12, tmp13), FIX_0_541196100);
+    out[2] = descale(_mm256_add_epi32(z1, mulc(tmp13, FIX_0_765366865)), shift);
+    out[6] = descale(_mm256_sub_epi32(z1, mulc(tmp12, FIX_1_847759065)), shift);
+
+    // odd part
+    z1 = _mm256_add_epi32(tmp4, tmp7);
+    __m256i z2 = _mm256_add_epi32(tmp5, tmp6);
+    __m256i z3 = _mm256_add_epi32(tmp4, tmp6);
+    __m256i z4 = _mm256_add_epi32(tmp5, tmp7);
+    __m256i z5 = mulc(_mm256_add_epi32(z3, z4), FIX_1_175875602);
+
+    tmp4 = mulc(tmp4, FIX_0_298631336);
+    tmp5 = mulc(tmp5, FIX_2_053119869);
+    tmp6 = mulc(tmp6, FIX_3_072711026);
+    tmp7 = mulc(tmp7, FIX_1_501321110);
+    z1 = mulc(z1, -FIX_0_899976223);
+    z2 = mulc(z2, -FIX_2_562915447);
+    z3 = _mm256_add_epi32(mulc(z3, -FIX_1_961570560), z5);
+    z4 = _mm256_add_epi32(mulc(z4, -FIX_0_390180644), z5);
+
+    out[7] = descale(_mm256_add_epi32(_mm256_add_epi32(tmp4, z1), z3), shift);
+    out[5] = descale(_mm256_add_epi32(_mm256_add_epi32(tmp5, z2), z4), shift);
+    out[3] = descale(_mm256_add_epi32(_mm256_add_epi32(tmp6, z2), z3), shift);
+    out[1] = descale(_mm256_add_epi32(_mm256_add_epi32(tmp7, z1), z4), shift);
+}
+
+/// in-register transpose of an 8x8 matrix of 32-bit lanes
+JPEG_TARGET_AVX2
+inline void transpose8x8(__m256i r[8]) {
+    __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+    __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+    __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+    __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+    __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+    __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+    __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+    __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+    __m256i s0 = _mm256_unpacklo_epi64(t0, t2);
+    __m256i s1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i s2 = _mm256_unpacklo_epi64(t1, t3);
+    __m256i s3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i s4 = _mm256_unpacklo_epi64(t4, t6);
+    __m256i s5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i s6 = _mm256_unpacklo_epi64(t5, t7);
+    __m256i s7 = _mm256_unpackhi_epi64(t5, t7);
+    r[0] = _mm256_permute2x128_si256(s0, s4, 0x20);
+    r[1] = _mm256_permute2x128_si256(s1, s5, 0x20);
+    r[2] = _mm256_permute2x128_si256(s2, s6, 0x20);
+    r[3] = _mm256_permute2x128_si256(s3, s7, 0x20);
+    r[4] = _mm256_permute2x128_si256(s0, s4, 0x31);
+    r[5] = _mm256_permute2x128_si256(s1, s5, 0x31);
+    r[6] = _mm256_permute2x128_si256(s2, s6, 0x31);
+    r[7] = _mm256_permute2x128_si256(s3, s7, 0x31);
+}
+
+///
+/// 8 blocks per call, lane k of every vector belongs to block k: each row is
+/// gathered from the 8 blocks with one transpose, so both 1-D passes are plain
+/// vertical arithmetic and the result is bit-exact with the scalar reference
+///
+JPEG_TARGET_AVX2
+void fdct8BlocksAVX2(const uint8_t* blocks, int16_t* dct) {
+    const __m256i center = _mm256_set1_epi32(128);
+    __m256i ws[8][8]; // ws[row][col], 8 blocks per vector
+    for (int r = 0; r < 8; ++r) {
+        __m256i v[8];
+        for (int k = 0; k < 8; ++k) {
+            __m128i row = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(blocks + k * 64 + r * 8));
+            v[k] = _mm256_sub_epi32(_mm256_cvtepu8_epi32(row), center);
+        }
+        transpose8x8(v); // v[c] = column c of row r for blocks 0..7
+        fdct1d(v, ws[r], CONST_BITS - PASS1_BITS, 0, true);
+    }
+    __m256i out[8][8]; // out[u][v]
+    for (int c = 0; c < 8; ++c) {
+        __m256i col[8], res[8];
+        for (int r = 0; r < 8; ++r) col[r] = ws[r][c];
+        fdct1d(col, res, CONST_BITS + PASS1_BITS + OUT_BITS, PASS1_BITS + OUT_BITS, false);
+        for (int u = 0; u < 8; ++u) out[u][c] = res[u];
+    }
+    for (int u = 0; u < 8; ++u) {
+        transpose8x8(out[u]); // out[u][k] = row u of block k
+    }
+    // rows u and u + 1 of a block narrowed to 16 bits and stored as one vector,
+    // packs interleaves the 128-bit halves, the permute restores row order
+    for (int u = 0; u < 8; u += 2) {
+        for (int k = 0; k < 8; ++k) {
+            __m256i rows = _mm256_permute4x64_epi64(_mm256_packs_epi32(out[u][k], out[u + 1][k]), 0xD8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dct + k * 64 + u * 8), rows);
+        }
+    }
+}
+#endif
+} // namespace
+
+void JpegDCT::fdct8x8Scalar(const uint8_t* block, int16_t* dct) {
+    int ws[64];
+    for (int r = 0; r < 8; ++r) {
+        int d[8];
+        for (int c = 0; c < 8; ++c) d[c] = block[r * 8 + c] - 128;
+        fdct1d(d, ws + r * 8, CONST_BITS - PASS1_BITS, 0, true);
+    }
+    for (int c = 0; c < 8; ++c) {
+        int d[8], res[8];
+        for (int r = 0; r < 8; ++r) d[r] = ws[r * 8 + c];
+        fdct1d(d, res, CONST_BITS + PASS1_BITS + OUT_BITS, PASS1_BITS + OUT_BITS, false);
+        for (int u = 0; u < 8; ++u) dct[u * 8 + c] = static_cast<int16_t>(res[u]);
+    }
+}
+
+void JpegDCT::fdctBlocks(const uint8_t* blocks, int16_t* dct, const size_t nblocks) {
+    size_t i = 0;
+#ifdef JPEG_X86_SIMD
+    if (cpuSupportsAVX2()) {
+        for (; i + 8 <= nblocks; i += 8) {
+            fdct8BlocksAVX2(blocks + i * 64, dct + i * 64);
+        }
+    }
+#endif
+    for (; i < nblocks; ++i) {
+        fdct8x8Scalar(blocks + i * 64, dct + i * 64);
+    }
+}
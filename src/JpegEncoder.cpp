@@ -1,8 +1,7 @@
 /// a more concise reference: https://www.jonolick.com/uploads/7/9/2/1/7921194/jo_jpeg.cpp
 
 #include "JpegEncoder.hpp"
-//#include "JpegDCT.hpp"
-#include "JpegZigzag.hpp"
+#include "JpegDCT.hpp"
 #include "HuffmanCodec.hpp"
 #include "JpegIO.hpp"
 
@@ -10,22 +9,12 @@
 #include <cmath>
 #include <stdexcept>
 #include <memory>
+#include <cstring>
 
 
-void JpegEncoder::encodeRGB(const Image<uint8_t> &rgb,
-                            const int quality, 
-                            YUVFormat format,
-                            const bool force_baseline
-                            ) {
-
-    /// step 0 : RGB -> YUV 
-    const int width = rgb.cols();
-    const int height = rgb.rows();
-    Image<uint8_t> yuv = JpegColor::rgbToYUV444(rgb);
-
-    /// step 1 : subsampling chrominance if required
-    int block_w = 8, block_h = 8;
-    int sx = 1, sy = 1;
+void JpegEncoder::samplingFactors(YUVFormat format, int &block_w, int &block_h, int &sx, int &sy) {
+    block_w = 8; block_h = 8;
+    sx = 1; sy = 1;
     if (format == YUVFormat::YUV444) {
         // do nothing 
     }
@@ -38,86 +27,411 @@ void JpegEncoder::encodeRGB(const Image<uint8_t> &rgb,
     } else {
         throw std::runtime_error("not supported yuv format!");
     }
+}
 
-    // step 2 : divide blocks
-    std::vector<uint8_t> y_blocks, u_blocks, v_blocks; 
-    JpegColor::sampleToBlocks(yuv, y_blocks, u_blocks, v_blocks,
-                              block_w, block_h, sx, sy);
+std::shared_ptr<HuffmanCodec> JpegEncoder::reusableCodec() {
+    if (!mHuffmanCodec) {
+        mHuffmanCodec = std::make_shared<HuffmanCodec>();
+    }
+    return mHuffmanCodec;
+}
+
+std::shared_ptr<JpegQuant> JpegEncoder::reusableQuantizer(const int quality, const bool force_baseline) {
+    if (!mQuantizer || mQuantizer->quality != quality || bool(mQuantizer->force_baseline) != force_baseline) {
+        mQuantizer = std::make_shared<JpegQuant>(quality, force_baseline);
+    }
+    return mQuantizer;
+}
+
+void JpegEncoder::transformRGB(const ImageView<uint8_t> &rgb,
+                               const int quality,
+                               YUVFormat format,
+                               JpegCoefficients &coefficients,
+                               const bool force_baseline
+                               ) {
+    coefficients.width = rgb.cols();
+    coefficients.height = rgb.rows();
+    coefficients.format = format;
+
+    /// step 0 : macroblock geometry of the chrominance subsampling
+    int block_w, block_h, sx, sy;
+    samplingFactors(format, block_w, block_h, sx, sy);
+
+    // step 1 & 2 : RGB -> YUV, subsampling and dividing blocks in a single pass,
+    // the blocks live in the arena, which is sized for this image
+    const size_t c_count = JpegColor::blockCount(rgb.cols(), rgb.rows(), block_w, block_h);
+    const size_t y_count = c_count * sx * sy;
+    mArena.reserve(JpegArena::footprint<uint8_t>(64 * y_count) + 2 * JpegArena::footprint<uint8_t>(64 * c_count));
+    uint8_t* y_blocks = mArena.allocate<uint8_t>(64 * y_count);
+    uint8_t* u_blocks = mArena.allocate<uint8_t>(64 * c_count);
+    uint8_t* v_blocks = mArena.allocate<uint8_t>(64 * c_count);
+    JpegColor::rgbToBlocks(rgb, y_blocks, u_blocks, v_blocks,
+                           block_w, block_h, sx, sy, mRowScratch);
 
 
     /// step 3: apply DCT for each 8x8 block
-    std::vector<int> y_dct = blocksToFDCT(y_blocks, 64);
-    std::vector<int> u_dct = blocksToFDCT(u_blocks, 64);
-    std::vector<int> v_dct = blocksToFDCT(v_blocks, 64);
+    blocksToFDCT(y_blocks, y_count, coefficients.y);
+    blocksToFDCT(u_blocks, c_count, coefficients.u);
+    blocksToFDCT(v_blocks, c_count, coefficients.v);
 
-    // quantization
-    std::shared_ptr<JpegQuant> quantizer = std::make_shared<JpegQuant>(quality, force_baseline);
-    fdctToQuant(quantizer.get(), y_dct, 64, true);
-    fdctToQuant(quantizer.get(), u_dct, 64, false);
-    fdctToQuant(quantizer.get(), v_dct, 64, false);
+    // quantization, output in zigzag order
+    coefficients.quantizer = reusableQuantizer(quality, force_baseline);
+    fdctToQuant(coefficients.quantizer.get(), coefficients.y.data(), y_count, true);
+    fdctToQuant(coefficients.quantizer.get(), coefficients.u.data(), c_count, false);
+    fdctToQuant(coefficients.quantizer.get(), coefficients.v.data(), c_count, false);
+}
 
-    // zigzag order
-    quantToZigzag(y_dct, 64);
-    quantToZigzag(u_dct, 64);
-    quantToZigzag(v_dct, 64);
+void JpegEncoder::prepareCodec(const JpegCoefficients &c, HuffmanCodec &huffmanCodec) {
+    huffmanCodec.setRestartInterval(mRestartRows, mThreads);
+    if (mOptimizeHuffman) {
+        huffmanCodec.optimizeTables(c.y.data(), c.u.data(), c.v.data(), c.width, c.height, c.format);
+    } else {
+        huffmanCodec.resetTables(); // the codec may carry the tables of a previous image
+    }
+}
 
+long JpegEncoder::entropyCode(const JpegCoefficients &c, HuffmanCodec &huffmanCodec) {
     // entropy encoding
-    std::shared_ptr<HuffmanCodec> huffmanCodec = std::make_shared<HuffmanCodec>();
-    long dataLength = huffmanCodec->encode(y_dct.data(), u_dct.data(), v_dct.data(), width, height, format);
-    std::cout << "JpegEncoder encode length:" << dataLength << std::endl; 
-    if (dataLength <= 0) {
-        return;
+    prepareCodec(c, huffmanCodec);
+    long dataLength = huffmanCodec.encode(c.y.data(), c.u.data(), c.v.data(), c.width, c.height, c.format);
+    if (mVerbose) {
+        std::cout << "JpegEncoder encode length:" << dataLength << std::endl; 
     }
+    return dataLength;
+}
 
-    // write to disk
-    const int* pqtab[2] = {quantizer->qtable_lumin.data(), quantizer->qtable_chrom.data()};
-    const uint8_t* huf_ac_tab[2] = {HuffmanCodec::STD_HUFTAB_LUMIN_AC, HuffmanCodec::STD_HUFTAB_CHROM_AC };
-    const uint8_t* huf_dc_tab[2] = {HuffmanCodec::STD_HUFTAB_LUMIN_DC, HuffmanCodec::STD_HUFTAB_CHROM_DC };
+long JpegEncoder::encodeScan(const ImageView<uint8_t> &rgb,
+                             const int quality,
+                             YUVFormat format,
+                             const bool force_baseline,
+                             JpegCoefficients &coefficients,
+                             HuffmanCodec &huffmanCodec
+                             ) {
+    transformRGB(rgb, quality, format, coefficients, force_baseline);
+    long dataLength = entropyCode(coefficients, huffmanCodec);
+    if (dataLength <= 0) {
+        throw std::runtime_error("JpegEncoder: entropy coding failed");
+    }
+    return dataLength;
+}
 
+void JpegEncoder::writeJpeg(const JpegCoefficients &c, const HuffmanCodec &huffmanCodec, JpegSink &sink) {
+    // header, scan and trailer in one write
+    const int* pqtab[2] = {c.quantizer->qtable_lumin.data(), c.quantizer->qtable_chrom.data()};
+    const uint8_t* huf_ac_tab[2] = {huffmanCodec.huffmanTable(false, true), huffmanCodec.huffmanTable(false, false)};
+    const uint8_t* huf_dc_tab[2] = {huffmanCodec.huffmanTable(true, true), huffmanCodec.huffmanTable(true, false)};
 
-    JpegIO::writeToFile(this->mOutputPath.c_str(),
-                        huffmanCodec->getResult(), dataLength, 
+    const std::vector<struct iovec> &scan = huffmanCodec.resultChunks();
+    bool ok = JpegIO::writeJpeg(sink,
+                        scan.data(), static_cast<int>(scan.size()),
                         pqtab, huf_ac_tab, huf_dc_tab, 
-                        width, height, format);
-    float ratio = width * height * 3 / dataLength;
-    std::cout<< "JPEG compression ratio:" << ratio << std::endl;
+                        c.width, c.height, c.format,
+                        huffmanCodec.restartIntervalMcus(c.width, c.format));
+    if (!ok) {
+        throw std::runtime_error("failed to write JPEG: " + sink.error());
+    }
+}
+
+void JpegEncoder::encodeRGB(const ImageView<uint8_t> &rgb,
+                            const int quality, 
+                            YUVFormat format,
+                            const bool force_baseline
+                            ) {
+    FdSink sink(this->mOutputPath.c_str());
+    if (!sink.isOpen()) {
+        throw std::runtime_error("failed to open output file: " + sink.error());
+    }
+    encodeRGB(rgb, quality, format, sink, force_baseline);
+    if (!sink.close()) {
+        throw std::runtime_error("failed to write " + this->mOutputPath + ": " + sink.error());
+    }
+}
+
+void JpegEncoder::encodeRGB(const ImageView<uint8_t> &rgb,
+                            const int quality, 
+                            YUVFormat format,
+                            JpegSink &sink,
+                            const bool force_baseline
+                            ) {
+    long dataLength;
+    if (mProgressive) {
+        dataLength = encodeProgressive(rgb, quality, format, force_baseline);
+        const JpegQuant &quantizer = *mCoefficients.quantizer;
+        const int* pqtab[2] = {quantizer.qtable_lumin.data(), quantizer.qtable_chrom.data()};
+        if (!JpegIO::writeProgressiveJpeg(sink, mProgressiveCoder->result().data(), dataLength, pqtab,
+                                          rgb.cols(), rgb.rows(), format)) {
+            throw std::runtime_error("failed to write JPEG: " + sink.error());
+        }
+    } else {
+        JpegCoefficients &coefficients = mCoefficients;
+        std::shared_ptr<HuffmanCodec> huffmanCodec = reusableCodec();
+        dataLength = encodeScan(rgb, quality, format, force_baseline, coefficients, *huffmanCodec);
+        writeJpeg(coefficients, *huffmanCodec, sink);
+    }
+    if (mVerbose) {
+        float ratio = rgb.cols() * rgb.rows() * 3 / dataLength;
+        std::cout<< "JPEG compression ratio:" << ratio << std::endl;
+    }
 }
 
+///
+/// header, scan and trailer of an encoded image assembled into dst;
+/// with dst == nullptr only the file size is returned. With scanInPlace the
+/// scan was coded at dst + headerSize already and is not copied
+///
+static size_t assembleJpeg(uint8_t* dst, const JpegQuant &quantizer, const HuffmanCodec &huffmanCodec,
+                           const long dataLength, const int width, const int height, YUVFormat format,
+                           const bool scanInPlace = false) {
+    const int* pqtab[2] = {quantizer.qtable_lumin.data(), quantizer.qtable_chrom.data()};
+    const uint8_t* huf_ac_tab[2] = {huffmanCodec.huffmanTable(false, true), huffmanCodec.huffmanTable(false, false)};
+    const uint8_t* huf_dc_tab[2] = {huffmanCodec.huffmanTable(true, true), huffmanCodec.huffmanTable(true, false)};
+    const int restart_interval = huffmanCodec.restartIntervalMcus(width, format);
 
+    if (!dst) {
+        return JpegIO::headerSize(huf_ac_tab, huf_dc_tab, restart_interval) + dataLength + JpegIO::TRAILER_SIZE;
+    }
+    uint8_t* p = dst;
+    p += JpegIO::writeHeader(p, pqtab, huf_ac_tab, huf_dc_tab, width, height, format, restart_interval);
+    if (scanInPlace) {
+        p += dataLength;
+    } else {
+        for (const struct iovec &piece : huffmanCodec.resultChunks()) {
+            std::memcpy(p, piece.iov_base, piece.iov_len);
+            p += piece.iov_len;
+        }
+    }
+    p += JpegIO::writeTrailer(p);
+    return p - dst;
+}
 
+long JpegEncoder::encodeProgressive(const ImageView<uint8_t> &rgb,
+                                    const int quality,
+                                    YUVFormat format,
+                                    const bool force_baseline
+                                    ) {
+    if (mRestartRows > 0) {
+        throw std::runtime_error("restart markers are not supported in progressive mode");
+    }
+    JpegCoefficients &c = mCoefficients;
+    transformRGB(rgb, quality, format, c, force_baseline);
+    if (!mProgressiveCoder) {
+        mProgressiveCoder = std::make_shared<JpegProgressive>();
+    }
+    long dataLength = mProgressiveCoder->encode(c.y.data(), c.u.data(), c.v.data(), c.width, c.height, c.format, mScript);
+    if (dataLength <= 0) {
+        throw std::runtime_error("JpegEncoder: entropy coding failed");
+    }
+    if (mVerbose) {
+        std::cout << "JpegEncoder encode length:" << dataLength << std::endl; 
+    }
+    return dataLength;
+}
 
+/// frame header, scans and trailer of a progressive encode; with dst == nullptr
+/// only the file size is returned
+static size_t assembleProgressive(uint8_t* dst, const JpegQuant &quantizer, const JpegProgressive &coder,
+                                  const int width, const int height, YUVFormat format) {
+    const std::vector<uint8_t> &scans = coder.result();
+    if (!dst) {
+        return JpegIO::FRAME_HEADER_SIZE + scans.size() + JpegIO::TRAILER_SIZE;
+    }
+    const int* pqtab[2] = {quantizer.qtable_lumin.data(), quantizer.qtable_chrom.data()};
+    uint8_t* p = dst;
+    p += JpegIO::writeFrameHeader(p, pqtab, width, height, format, true);
+    std::memcpy(p, scans.data(), scans.size());
+    p += scans.size();
+    p += JpegIO::writeTrailer(p);
+    return p - dst;
+}
 
+size_t JpegEncoder::maxEncodedSize(const int w, const int h, YUVFormat format, const int restartRows) {
+    return JpegIO::MAX_HEADER_SIZE + HuffmanCodec::maxScanBytes(w, h, format, restartRows) + JpegIO::TRAILER_SIZE;
+}
 
-std::vector<int> JpegEncoder::blocksToFDCT(const std::vector<uint8_t> &blocks, const int block_stride) {
-    const int block_numel = blocks.size() / block_stride;
-    ASSERT(blocks.size() % block_stride == 0, " blocks.size() % block_stride != 0");
-    std::vector<int> dct(blocks.size());
+long JpegEncoder::encodeToBuffer(const ImageView<uint8_t> &rgb,
+                                 const int quality,
+                                 YUVFormat format,
+                                 uint8_t* dst, const size_t dst_capacity,
+                                 const bool force_baseline
+                                 ) {
+    if (mProgressive) {
+        encodeProgressive(rgb, quality, format, force_baseline);
+        const size_t size = assembleProgressive(nullptr, *mCoefficients.quantizer, *mProgressiveCoder, rgb.cols(), rgb.rows(), format);
+        if (size > dst_capacity) {
+            return -1;
+        }
+        return assembleProgressive(dst, *mCoefficients.quantizer, *mProgressiveCoder, rgb.cols(), rgb.rows(), format);
+    }
+    JpegCoefficients &coefficients = mCoefficients;
+    std::shared_ptr<HuffmanCodec> huffmanCodec = reusableCodec();
+    // the tables are fixed before coding, so a buffer that fits the worst case takes
+    // the scan right behind the header; parallel restart intervals and smaller buffers
+    // are coded into the codec's chunks and copied
+    if ((mRestartRows == 0 || mThreads == 1) &&
+        dst_capacity >= maxEncodedSize(rgb.cols(), rgb.rows(), format, mRestartRows)) {
+        transformRGB(rgb, quality, format, coefficients, force_baseline);
+        prepareCodec(coefficients, *huffmanCodec);
+        const size_t header = assembleJpeg(nullptr, *coefficients.quantizer, *huffmanCodec, 0,
+                                           rgb.cols(), rgb.rows(), format) - JpegIO::TRAILER_SIZE;
+        const long dataLength = huffmanCodec->encodeInto(dst + header, dst_capacity - header - JpegIO::TRAILER_SIZE,
+                                                         coefficients.y.data(), coefficients.u.data(), coefficients.v.data(),
+                                                         coefficients.width, coefficients.height, coefficients.format);
+        if (dataLength <= 0) {
+            throw std::runtime_error("JpegEncoder: entropy coding failed");
+        }
+        if (mVerbose) {
+            std::cout << "JpegEncoder encode length:" << dataLength << std::endl; 
+        }
+        return assembleJpeg(dst, *coefficients.quantizer, *huffmanCodec, dataLength, rgb.cols(), rgb.rows(), format, true);
+    }
+    long dataLength = encodeScan(rgb, quality, format, force_baseline, coefficients, *huffmanCodec);
+    const size_t size = assembleJpeg(nullptr, *coefficients.quantizer, *huffmanCodec, dataLength, rgb.cols(), rgb.rows(), format);
+    if (size > dst_capacity) {
+        return -1;
+    }
+    return assembleJpeg(dst, *coefficients.quantizer, *huffmanCodec, dataLength, rgb.cols(), rgb.rows(), format);
+}
 
-    for (int block_id = 0; block_id < block_numel; ++block_id) {
-        /* TODO: apply DCT transform to each block, this operation is in-place*/
-        throw std::runtime_error("TODO: blocksToFDCT was not implemented!");
+std::vector<uint8_t> JpegEncoder::encodeToBuffer(const ImageView<uint8_t> &rgb,
+                                                 const int quality,
+                                                 YUVFormat format,
+                                                 const bool force_baseline
+                                                 ) {
+    if (mProgressive) {
+        encodeProgressive(rgb, quality, format, force_baseline);
+        std::vector<uint8_t> jpeg(assembleProgressive(nullptr, *mCoefficients.quantizer, *mProgressiveCoder, rgb.cols(), rgb.rows(), format));
+        assembleProgressive(jpeg.data(), *mCoefficients.quantizer, *mProgressiveCoder, rgb.cols(), rgb.rows(), format);
+        return jpeg;
     }
-    return dct;
+    JpegCoefficients &coefficients = mCoefficients;
+    std::shared_ptr<HuffmanCodec> huffmanCodec = reusableCodec();
+    long dataLength = encodeScan(rgb, quality, format, force_baseline, coefficients, *huffmanCodec);
+    std::vector<uint8_t> jpeg(assembleJpeg(nullptr, *coefficients.quantizer, *huffmanCodec, dataLength, rgb.cols(), rgb.rows(), format));
+    assembleJpeg(jpeg.data(), *coefficients.quantizer, *huffmanCodec, dataLength, rgb.cols(), rgb.rows(), format);
+    return jpeg;
 }
 
-void JpegEncoder::fdctToQuant(JpegQuant* quantizer, 
-                              std::vector<int> &dct, 
-                              const int block_stride, 
-                              const bool luminance  
-                              ) {
-    const int block_numel = dct.size() / block_stride;
- 
-    for (size_t block_id = 0; block_id < block_numel; ++block_id) {
-        quantizer->quantEncode8x8(dct.data() + block_id * block_stride, luminance);
+
+
+
+
+
+///
+/// streaming mode: every stage runs on one row of macroblocks at a time and the
+/// entropy-coded bytes of the row go to the file right away, so besides the input
+/// only O(width) working memory is used
+///
+void JpegEncoder::encodeRGBStreaming(const ImageView<uint8_t> &rgb,
+                                     const int quality,
+                                     YUVFormat format,
+                                     const bool force_baseline
+                                     ) {
+    FdSink sink(this->mOutputPath.c_str());
+    if (!sink.isOpen()) {
+        throw std::runtime_error("failed to open output file: " + sink.error());
+    }
+    encodeRGBStreaming(rgb, quality, format, sink, force_baseline);
+    if (!sink.close()) {
+        throw std::runtime_error("failed to write " + this->mOutputPath + ": " + sink.error());
     }
 }
 
-void JpegEncoder::quantToZigzag(std::vector<int> &quant,
-                                const int block_stride
-                               ) {
-    const int block_numel = quant.size() / block_stride;
-    std::shared_ptr<JpegZigzag> zigzag = std::make_shared<JpegZigzag>();
-    for (size_t block_id = 0; block_id < block_numel; ++block_id) {
-        zigzag->zigzag(quant.data() + block_id * block_stride);
+void JpegEncoder::encodeRGBStreaming(const ImageView<uint8_t> &rgb,
+                                     const int quality,
+                                     YUVFormat format,
+                                     JpegSink &sink,
+                                     const bool force_baseline
+                                     ) {
+    if (mOptimizeHuffman) {
+        // the tables go into the header before the first row is coded
+        throw std::runtime_error("optimized Huffman tables need the full mode");
     }
+    if (mProgressive) {
+        // every scan visits the whole image
+        throw std::runtime_error("progressive output needs the full mode");
+    }
+    const int width = rgb.cols();
+    const int height = rgb.rows();
+    int block_w, block_h, sx, sy;
+    samplingFactors(format, block_w, block_h, sx, sy);
+    const int block_nw = (width + block_w - 1) / block_w;
+    const int block_nh = (height + block_h - 1) / block_h;
+
+    // per macroblock row buffers, from the arena
+    const size_t y_count = size_t(block_nw) * sx * sy;
+    const size_t c_count = block_nw;
+    mArena.reserve(JpegArena::footprint<uint8_t>(64 * y_count) + 2 * JpegArena::footprint<uint8_t>(64 * c_count) +
+                   JpegArena::footprint<int16_t>(64 * y_count) + 2 * JpegArena::footprint<int16_t>(64 * c_count));
+    uint8_t* y_blocks = mArena.allocate<uint8_t>(64 * y_count);
+    uint8_t* u_blocks = mArena.allocate<uint8_t>(64 * c_count);
+    uint8_t* v_blocks = mArena.allocate<uint8_t>(64 * c_count);
+    int16_t* y_dct = mArena.allocate<int16_t>(64 * y_count);
+    int16_t* u_dct = mArena.allocate<int16_t>(64 * c_count);
+    int16_t* v_dct = mArena.allocate<int16_t>(64 * c_count);
+
+    std::shared_ptr<JpegQuant> quantizer = reusableQuantizer(quality, force_baseline);
+    std::shared_ptr<HuffmanCodec> huffmanCodec = reusableCodec();
+    huffmanCodec->setRestartInterval(mRestartRows);
+    huffmanCodec->resetTables();
+
+    const int* pqtab[2] = {quantizer->qtable_lumin.data(), quantizer->qtable_chrom.data()};
+    const uint8_t* huf_ac_tab[2] = {huffmanCodec->huffmanTable(false, true), huffmanCodec->huffmanTable(false, false)};
+    const uint8_t* huf_dc_tab[2] = {huffmanCodec->huffmanTable(true, true), huffmanCodec->huffmanTable(true, false)};
+
+    uint8_t header[JpegIO::MAX_HEADER_SIZE];
+    size_t headerSize = JpegIO::writeHeader(header, pqtab, huf_ac_tab, huf_dc_tab, width, height, format,
+                                            huffmanCodec->restartIntervalMcus(width, format));
+    bool ok = sink.write(header, headerSize);
+
+    huffmanCodec->beginScan(HuffmanCodec::MAX_BLOCK_BYTES * (y_count + c_count * 2) + 64);
+    long dataLength = 0;
+    for (int by = 0; by < block_nh && ok; ++by) {
+        if (mRestartRows > 0 && by > 0 && by % mRestartRows == 0) {
+            huffmanCodec->writeRestart(by / mRestartRows - 1);
+        }
+        JpegColor::mcuRowToBlocks(rgb, by, y_blocks, u_blocks, v_blocks,
+                                  block_w, block_h, sx, sy, mRowScratch);
+        JpegDCT::fdctBlocks(y_blocks, y_dct, y_count);
+        JpegDCT::fdctBlocks(u_blocks, u_dct, c_count);
+        JpegDCT::fdctBlocks(v_blocks, v_dct, c_count);
+        fdctToQuant(quantizer.get(), y_dct, y_count, true);
+        fdctToQuant(quantizer.get(), u_dct, c_count, false);
+        fdctToQuant(quantizer.get(), v_dct, c_count, false);
+
+        long n = huffmanCodec->encodeMcus(y_dct, u_dct, v_dct, block_nw, format);
+        ok = n >= 0 && sink.write(huffmanCodec->getResult(), n);
+        huffmanCodec->rewind();
+        dataLength += n;
+    }
+    long n = ok ? huffmanCodec->finishScan() : -1;
+    if (n >= 0) {
+        // the scan tail goes out together with EOI
+        uint8_t trailer[JpegIO::TRAILER_SIZE];
+        struct iovec iov[2];
+        iov[0].iov_base = huffmanCodec->getResult();
+        iov[0].iov_len = n;
+        iov[1].iov_base = trailer;
+        iov[1].iov_len = JpegIO::writeTrailer(trailer);
+        ok = sink.write(iov, 2);
+        dataLength += n;
+    }
+    if (!ok || n < 0) {
+        throw std::runtime_error("failed to write JPEG: " + (sink.error().empty() ? std::string("entropy coding failed") : sink.error()));
+    }
+    if (mVerbose) {
+        std::cout << "JpegEncoder encode length:" << dataLength << std::endl; 
+    }
+}
+
+void JpegEncoder::blocksToFDCT(const uint8_t* blocks, const size_t nblocks, AlignedVector<int16_t> &dct) {
+    dct.resize(64 * nblocks);
+    JpegDCT::fdctBlocks(blocks, dct.data(), nblocks);
+}
+
+void JpegEncoder::fdctToQuant(const JpegQuant* quantizer, 
+                              int16_t* dct,
+                              const size_t nblocks,
+                              const bool luminance  
+                              ) {
+    quantizer->quantZigzagBlocks(dct, dct, nblocks, luminance);
 }
@@ -1,10 +1,10 @@
 #include "JpegIO.hpp"
 #include "JpegZigzag.hpp"
 
-extern "C" {
-#include "../3rdparty/bitstr.h"
-}
 #include <stdexcept>
+#include <cstring>
+#include <vector>
+#include <algorithm>
 
 bool JpegIO::writeToFile(const char* dst_file, 
                          const char* buffer, 
@@ -13,39 +13,138 @@ bool JpegIO::writeToFile(const char* dst_file,
                          const uint8_t* huf_ac_tab[2],
                          const uint8_t* huf_dc_tab[2],  
                          const int w, const int h, 
-                         YUVFormat format) {
-    FILE *fp = fopen(dst_file, "wb");
+                         YUVFormat format,
+                         const int restart_interval) {
+    FdSink sink(dst_file);
+    bool ok = writeJpeg(sink, buffer, dataLength, quant_tab, huf_ac_tab, huf_dc_tab,
+                        w, h, format, restart_interval);
+    return sink.close() && ok;
+}
+
+bool JpegIO::writeJpeg(JpegSink& sink,
+                       const char* buffer,
+                       long dataLength,
+                       const int* quant_tab[2],
+                       const uint8_t* huf_ac_tab[2],
+                       const uint8_t* huf_dc_tab[2],
+                       const int w, const int h,
+                       YUVFormat format,
+                       const int restart_interval) {
+    struct iovec scan;
+    scan.iov_base = const_cast<char*>(buffer);
+    scan.iov_len = dataLength;
+    return writeJpeg(sink, &scan, 1, quant_tab, huf_ac_tab, huf_dc_tab, w, h, format, restart_interval);
+}
+
+bool JpegIO::writeJpeg(JpegSink& sink,
+                       const struct iovec* scan,
+                       const int scanCount,
+                       const int* quant_tab[2],
+                       const uint8_t* huf_ac_tab[2],
+                       const uint8_t* huf_dc_tab[2],
+                       const int w, const int h,
+                       YUVFormat format,
+                       const int restart_interval) {
+    uint8_t header[MAX_HEADER_SIZE];
+    uint8_t trailer[TRAILER_SIZE];
+    std::vector<struct iovec> iov(scanCount + 2);
+    iov[0].iov_base = header;
+    iov[0].iov_len = writeHeader(header, quant_tab, huf_ac_tab, huf_dc_tab, w, h, format, restart_interval);
+    std::copy(scan, scan + scanCount, iov.begin() + 1);
+    iov[scanCount + 1].iov_base = trailer;
+    iov[scanCount + 1].iov_len = writeTrailer(trailer);
+    return sink.write(iov.data(), static_cast<int>(iov.size()));
+}
+
+static size_t huffmanTableSize(const uint8_t* huf_tab) {
+    size_t len = 16;
+    for (int j = 0; j < 16; j++) {
+        len += huf_tab[j];
+    }
+    return len;
+}
+
+static uint8_t* putMarker(uint8_t* p, uint8_t code, size_t len) {
+    p[0] = 0xff;
+    p[1] = code;
+    p[2] = uint8_t(len >> 8);
+    p[3] = uint8_t(len >> 0);
+    return p + 4;
+}
+
+size_t JpegIO::headerSize(const uint8_t* huf_ac_tab[2],
+                          const uint8_t* huf_dc_tab[2],
+                          const int restart_interval) {
+    size_t size = 2                           // SOI
+                + 2 * (2 + 2 + 1 + 64)        // DQT
+                + 2 + 2 + 1 + 2 + 2 + 1 + 3 * 3 // SOF0
+                + (restart_interval > 0 ? 6 : 0) // DRI
+                + 2 + 2 + 1 + 2 * 3 + 3;      // SOS
+    for (int i = 0; i < 2; i++) {
+        size += 2 + 2 + 1 + huffmanTableSize(huf_ac_tab[i]);
+        size += 2 + 2 + 1 + huffmanTableSize(huf_dc_tab[i]);
+    }
+    return size;
+}
+
+size_t JpegIO::writeHeader(uint8_t* dst,
+                           const int* quant_tab[2],
+                           const uint8_t* huf_ac_tab[2],
+                           const uint8_t* huf_dc_tab[2],
+                           const int w, const int h,
+                           YUVFormat format,
+                           const int restart_interval) {
+    uint8_t* p = dst;
+    p += writeFrameHeader(p, quant_tab, w, h, format);
+
+    // DHT AC, then DC
+    for (int dc = 0; dc < 2; dc++) {
+        for (int i = 0; i < 2; i++) {
+            p += writeHuffmanTable(p, dc ? huf_dc_tab[i] : huf_ac_tab[i], dc != 0, i);
+        }
+    }
 
+    // DRI
+    if (restart_interval > 0) {
+        p = putMarker(p, 0xdd, 4);
+        *p++ = uint8_t(restart_interval >> 8);
+        *p++ = uint8_t(restart_interval >> 0);
+    }
+
+    // SOS, all components and coefficients in one scan
+    const int components[3] = {0, 1, 2};
+    p += writeScanHeader(p, components, 3, 0, 63, 0, 0);
+
+    return p - dst;
+}
+
+size_t JpegIO::writeFrameHeader(uint8_t* dst,
+                                const int* quant_tab[2],
+                                const int w, const int h,
+                                YUVFormat format,
+                                const bool progressive) {
+    uint8_t* p = dst;
     // SOI
-    fputc(0xff, fp);
-    fputc(0xd8, fp);
-     
+    *p++ = 0xff;
+    *p++ = 0xd8;
 
     // DQT
     for (int i = 0; i < 2; i++) {
-        int len = 2 + 1 + 64;
-        fputc(0xff, fp);
-        fputc(0xdb, fp);
-        fputc(len >> 8, fp);
-        fputc(len >> 0, fp);
-        fputc(i, fp);
+        p = putMarker(p, 0xdb, 2 + 1 + 64);
+        *p++ = uint8_t(i);
         for (int j = 0; j < 64; j++) {
-            fputc(quant_tab[i][JpegZigzag::ZIGZAG_INDEX[j]], fp);
+            *p++ = uint8_t(quant_tab[i][JpegZigzag::ZIGZAG_INDEX[j]]);
         }
     }
 
-    // SOF0
-    int SOF0Len = 2 + 1 + 2 + 2 + 1 + 3 * 3;
-    fputc(0xff, fp);
-    fputc(0xc0, fp);
-    fputc(SOF0Len >> 8, fp);
-    fputc(SOF0Len >> 0, fp);
-    fputc(8, fp); // precision 8bit
-    fputc(h >> 8, fp); // height
-    fputc(h >> 0, fp); // height
-    fputc(w >> 8, fp); // width
-    fputc(w >> 0, fp); // width
-    fputc(3, fp); 
+    // SOF0, or SOF2 for progressive scans
+    p = putMarker(p, progressive ? 0xc2 : 0xc0, 2 + 1 + 2 + 2 + 1 + 3 * 3);
+    *p++ = 8; // precision 8bit
+    *p++ = uint8_t(h >> 8); // height
+    *p++ = uint8_t(h >> 0);
+    *p++ = uint8_t(w >> 8); // width
+    *p++ = uint8_t(w >> 0);
+    *p++ = 3;
 
     // Y, U, V 
     unsigned char chrom[] = {0x01, 0x11, 0x00, 
@@ -61,60 +160,55 @@ bool JpegIO::writeToFile(const char* dst_file,
     } else {
         throw std::runtime_error("unsupported yuv format!");
     }
-    for(int i = 0; i < 9; ++i) fputc(chrom[i], fp);
+    for(int i = 0; i < 9; ++i) *p++ = chrom[i];
 
-    // DHT AC
-    for (int i = 0; i < 2; i++) {
-        fputc(0xff, fp);
-        fputc(0xc4, fp);
-        int len = 2 + 1 + 16;
-        for (int j = 0; j < 16; j++) {
-            len += huf_ac_tab[i][j];
-        }
-        fputc(len >> 8, fp);
-        fputc(len >> 0, fp);
-        fputc(i + 0x10, fp);
-        fwrite(huf_ac_tab[i], len - 3, 1, fp);
-    }
-    // DHT DC
-    for (int i = 0; i < 2; i++) {
-        fputc(0xff, fp);
-        fputc(0xc4, fp);
-        int len = 2 + 1 + 16;
-        for (int j = 0; j < 16; j++) {
-            len += huf_dc_tab[i][j];
-        }
-        fputc(len >> 8, fp);
-        fputc(len >> 0, fp);
-        fputc(i + 0x00, fp);
-        fwrite(huf_dc_tab[i], len - 3, 1, fp);
-    }
-
-    // SOS
-    int SOSLen = 2 + 1 + 2 * 3 + 3;
-    fputc(0xff, fp);
-    fputc(0xda, fp);
-    fputc(SOSLen >> 8, fp);
-    fputc(SOSLen >> 0, fp);
-    fputc(3, fp);
+    return p - dst;
+}
 
-    fputc(0x01, fp); fputc(0x00, fp);
-    fputc(0x02, fp); fputc(0x11, fp);
-    fputc(0x03, fp); fputc(0x11, fp);
+size_t JpegIO::writeHuffmanTable(uint8_t* dst, const uint8_t* huf_tab, const bool dc, const int id) {
+    const size_t len = huffmanTableSize(huf_tab);
+    uint8_t* p = putMarker(dst, 0xc4, 2 + 1 + len);
+    *p++ = uint8_t(id + (dc ? 0x00 : 0x10));
+    std::memcpy(p, huf_tab, len);
+    return p + len - dst;
+}
 
-    fputc(0x00, fp);
-    fputc(0x3F, fp);
-    fputc(0x00, fp);
+size_t JpegIO::writeScanHeader(uint8_t* dst, const int* components, const int count,
+                               const int Ss, const int Se, const int Ah, const int Al) {
+    uint8_t* p = putMarker(dst, 0xda, 2 + 1 + 2 * count + 3);
+    *p++ = uint8_t(count);
+    for (int i = 0; i < count; i++) {
+        // component ids 1..3, luminance codes with tables 0, chrominance with tables 1
+        *p++ = uint8_t(components[i] + 1);
+        *p++ = components[i] == 0 ? 0x00 : 0x11;
+    }
+    *p++ = uint8_t(Ss);
+    *p++ = uint8_t(Se);
+    *p++ = uint8_t((Ah << 4) | Al);
+    return p - dst;
+}
 
-    // data
-    fwrite(buffer, dataLength, 1, fp);
+bool JpegIO::writeProgressiveJpeg(JpegSink& sink,
+                                  const uint8_t* scans,
+                                  const size_t length,
+                                  const int* quant_tab[2],
+                                  const int w, const int h,
+                                  YUVFormat format) {
+    uint8_t header[FRAME_HEADER_SIZE];
+    uint8_t trailer[TRAILER_SIZE];
+    struct iovec iov[3];
+    iov[0].iov_base = header;
+    iov[0].iov_len = writeFrameHeader(header, quant_tab, w, h, format, true);
+    iov[1].iov_base = const_cast<uint8_t*>(scans);
+    iov[1].iov_len = length;
+    iov[2].iov_base = trailer;
+    iov[2].iov_len = writeTrailer(trailer);
+    return sink.write(iov, 3);
+}
 
+size_t JpegIO::writeTrailer(uint8_t* dst) {
     // EOI
-    fputc(0xff, fp);
-    fputc(0xd9, fp);
-
-    fflush(fp);
-    fclose(fp);
-
-    return true;
+    dst[0] = 0xff;
+    dst[1] = 0xd9;
+    return TRAILER_SIZE;
 }
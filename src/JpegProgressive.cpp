@@ -0,0 +1,368 @@
+/// progressive coding follows jcphuff.c of libjpeg: https://github.com/libjpeg-turbo/libjpeg-turbo
+
+#include "JpegProgressive.hpp"
+#include "common.hpp"
+#include "HuffmanCodec.hpp"
+#include "JpegBitWriter.hpp"
+#include "JpegIO.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+static JpegScan makeScan(const int component, const int Ss, const int Se, const int Ah, const int Al) {
+    JpegScan scan = {1, {component, 0, 0}, Ss, Se, Ah, Al};
+    return scan;
+}
+
+static JpegScan makeDcScan(const int Ah, const int Al) {
+    JpegScan scan = {3, {0, 1, 2}, 0, 0, Ah, Al};
+    return scan;
+}
+
+std::vector<JpegScan> JpegProgressive::defaultScript() {
+    return {
+        makeDcScan(0, 1),
+        makeScan(0, 1, 5, 0, 2),
+        makeScan(2, 1, 63, 0, 1),
+        makeScan(1, 1, 63, 0, 1),
+        makeScan(0, 6, 63, 0, 2),
+        makeScan(0, 1, 63, 2, 1),
+        makeDcScan(1, 0),
+        makeScan(2, 1, 63, 1, 0),
+        makeScan(1, 1, 63, 1, 0),
+        makeScan(0, 1, 63, 1, 0),
+    };
+}
+
+void JpegProgressive::validateScript(const std::vector<JpegScan> &script) {
+    // lowest bit position coded so far per component and coefficient, -1: none
+    int coded[3][64];
+    std::memset(coded, -1, sizeof(coded));
+
+    for (size_t n = 0; n < script.size(); ++n) {
+        const JpegScan &scan = script[n];
+        const std::string where = "scan script entry " + std::to_string(n) + ": ";
+        if (scan.componentCount < 1 || scan.componentCount > 3) {
+            throw std::runtime_error(where + "1 to 3 components per scan");
+        }
+        if (scan.Ss < 0 || scan.Se < scan.Ss || scan.Se > 63 || (scan.Ss == 0 && scan.Se != 0)) {
+            throw std::runtime_error(where + "invalid spectral selection");
+        }
+        if (scan.Ss > 0 && scan.componentCount != 1) {
+            throw std::runtime_error(where + "AC scans code a single component");
+        }
+        if (scan.Al < 0 || scan.Al > MAX_AL || (scan.Ah != 0 && scan.Ah != scan.Al + 1)) {
+            throw std::runtime_error(where + "invalid successive approximation");
+        }
+        for (int i = 0; i < scan.componentCount; ++i) {
+            const int c = scan.components[i];
+            if (c < 0 || c > 2 || (i > 0 && c <= scan.components[i - 1])) {
+                throw std::runtime_error(where + "components must be distinct and in frame order");
+            }
+            if (scan.Ss > 0 && coded[c][0] < 0) {
+                throw std::runtime_error(where + "AC scan before the first DC scan of its component");
+            }
+            for (int k = scan.Ss; k <= scan.Se; ++k) {
+                if (scan.Ah == 0 ? coded[c][k] >= 0 : coded[c][k] != scan.Ah) {
+                    throw std::runtime_error(where + "coefficient coded out of order");
+                }
+                coded[c][k] = scan.Al;
+            }
+        }
+    }
+    for (int c = 0; c < 3; ++c) {
+        for (int k = 0; k < 64; ++k) {
+            if (coded[c][k] != 0) {
+                throw std::runtime_error("scan script does not code every coefficient to full precision");
+            }
+        }
+    }
+}
+
+namespace {
+
+///
+/// the coding rules of the four scan types; Output decides what a symbol is:
+/// a count in the statistics pass, a code in the writing pass
+///
+template <typename Output>
+class ScanCoder {
+public:
+    explicit ScanCoder(Output &out): mOut(out), mEobRun(0), mCorrBits(0) {
+        mLastDc[0] = mLastDc[1] = mLastDc[2] = 0;
+    }
+
+    /// DC difference of the point-transformed DC, the DC table of the component
+    void dcFirst(const int component, const int16_t* block, const int Al) {
+        const int dc = block[0] >> Al; // arithmetic shift, as the decoder scales back
+        int diff = dc - mLastDc[component];
+        mLastDc[component] = dc;
+        const int table = component == 0 ? 0 : 1;
+        const uint32_t magnitude = diff < 0 ? -diff : diff;
+        const int nbits = HuffmanCodec::magnitudeCategory(magnitude);
+        if (diff < 0) diff--;
+        mOut.symbol(table, nbits);
+        mOut.bits(uint32_t(diff) & ((1u << nbits) - 1), nbits);
+    }
+
+    /// one more bit of the DC, no Huffman coding
+    void dcRefine(const int16_t* block, const int Al) {
+        mOut.bits((block[0] >> Al) & 1, 1);
+    }
+
+    /// the band Ss..Se at bit Al, runs of empty blocks are coded as EOBRUN
+    void acFirst(const int table, const int16_t* block, const int Ss, const int Se, const int Al) {
+        int r = 0;
+        for (int k = Ss; k <= Se; ++k) {
+            int v = block[k];
+            if (v == 0) { r++; continue; }
+            uint32_t magnitude, bits;
+            if (v < 0) {
+                magnitude = uint32_t(-v) >> Al;
+                bits = ~magnitude;
+            } else {
+                magnitude = uint32_t(v) >> Al;
+                bits = magnitude;
+            }
+            if (magnitude == 0) { r++; continue; }
+            flushEobRun(table);
+            while (r > 15) {
+                mOut.symbol(table, 0xF0);
+                r -= 16;
+            }
+            const int nbits = HuffmanCodec::magnitudeCategory(magnitude);
+            mOut.symbol(table, (r << 4) + nbits);
+            mOut.bits(bits & ((1u << nbits) - 1), nbits);
+            r = 0;
+        }
+        if (r > 0) {
+            if (++mEobRun == 0x7FFF) flushEobRun(table);
+        }
+    }
+
+    ///
+    /// bit Al of the band Ss..Se: coefficients that become nonzero are coded as in
+    /// acFirst, the bits of those already nonzero go raw after the next symbol
+    ///
+    void acRefine(const int table, const int16_t* block, const int Ss, const int Se, const int Al) {
+        int magnitude[64];
+        int eob = 0; // last coefficient that becomes nonzero at this bit
+        for (int k = Ss; k <= Se; ++k) {
+            const int v = block[k];
+            magnitude[k] = (v < 0 ? -v : v) >> Al;
+            if (magnitude[k] == 1) eob = k;
+        }
+
+        int r = 0;
+        int pending = 0;              // correction bits of this block
+        uint8_t* blockBits = mCorr + mCorrBits;
+        for (int k = Ss; k <= Se; ++k) {
+            const int m = magnitude[k];
+            if (m == 0) { r++; continue; }
+            // a zero run is only split by ZRL ahead of a newly nonzero coefficient
+            while (r > 15 && k <= eob) {
+                flushEobRun(table);
+                mOut.symbol(table, 0xF0);
+                r -= 16;
+                emitCorrection(blockBits, pending);
+                blockBits = mCorr;
+                pending = 0;
+            }
+            if (m > 1) {
+                blockBits[pending++] = uint8_t(m & 1);
+                continue;
+            }
+            flushEobRun(table);
+            mOut.symbol(table, (r << 4) + 1);
+            mOut.bits(block[k] < 0 ? 0 : 1, 1);
+            emitCorrection(blockBits, pending);
+            blockBits = mCorr;
+            pending = 0;
+            r = 0;
+        }
+        if (r > 0 || pending > 0) {
+            // the rest of the block joins the EOB run, its correction bits follow the run
+            mEobRun++;
+            mCorrBits += pending;
+            if (mEobRun == 0x7FFF || mCorrBits > MAX_CORR_BITS - 64 + 1) flushEobRun(table);
+        }
+    }
+
+    /// end of scan: the open EOB run and its correction bits
+    void finish(const int table) {
+        flushEobRun(table);
+    }
+
+private:
+    void flushEobRun(const int table) {
+        if (mEobRun == 0) return;
+        const int nbits = HuffmanCodec::magnitudeCategory(mEobRun) - 1;
+        mOut.symbol(table, nbits << 4);
+        mOut.bits(mEobRun & ((1u << nbits) - 1), nbits);
+        mEobRun = 0;
+        emitCorrection(mCorr, mCorrBits);
+        mCorrBits = 0;
+    }
+
+    void emitCorrection(const uint8_t* bits, const int n) {
+        for (int i = 0; i < n; ++i) mOut.bits(bits[i], 1);
+    }
+
+    static const int MAX_CORR_BITS = 1000; // correction bits buffered across an EOB run
+
+    Output &mOut;
+    int mLastDc[3];
+    uint32_t mEobRun;
+    int mCorrBits;
+    uint8_t mCorr[MAX_CORR_BITS];
+};
+
+/// statistics pass: symbol frequencies per table id and the extra bits
+struct SymbolCounter {
+    long freq[2][256];
+    uint64_t extraBits;
+
+    SymbolCounter(): extraBits(0) { std::memset(freq, 0, sizeof(freq)); }
+    void symbol(const int table, const int s) { freq[table][s]++; }
+    void bits(uint32_t, const int n) { extraBits += n; }
+};
+
+/// writing pass: codes of the scan's tables into a bit writer
+struct SymbolWriter {
+    JpegBitWriter writer;
+    uint32_t codes[2][256];
+
+    void symbol(const int table, const int s) {
+        const uint32_t entry = codes[table][s];
+        writer.putBits(entry & 0xffff, entry >> 16);
+    }
+    void bits(const uint32_t bits, const int n) { writer.putBits(bits, n); }
+};
+
+}
+
+///
+/// visit the blocks of a scan in coding order: MCU by MCU for interleaved (DC)
+/// scans, else the component's blocks row by row, leaving out the blocks that
+/// only pad its MCUs (A.2.2, A.2.3)
+///
+template <typename Visit>
+void JpegProgressive::codeScan(const Visit &visit, const JpegScan &scan) const {
+    const Layout &l = mLayout;
+    const int lumaPerMcu = l.sx * l.sy;
+    if (scan.componentCount > 1) {
+        for (size_t m = 0; m < l.mcus; ++m) {
+            for (int i = 0; i < scan.componentCount; ++i) {
+                const int c = scan.components[i];
+                const int count = c == 0 ? lumaPerMcu : 1;
+                for (int b = 0; b < count; ++b) {
+                    visit(c, l.planes[c] + (m * count + b) * 64);
+                }
+            }
+        }
+        return;
+    }
+    const int c = scan.components[0];
+    for (int by = 0; by < l.blocksHigh[c]; ++by) {
+        for (int bx = 0; bx < l.blocksWide[c]; ++bx) {
+            size_t index;
+            if (c == 0) {
+                // luminance blocks are stored MCU by MCU, each MCU row-major
+                index = (size_t(by / l.sy) * l.mcuWide + bx / l.sx) * lumaPerMcu
+                      + (by % l.sy) * l.sx + bx % l.sx;
+            } else {
+                index = size_t(by) * l.mcuWide + bx;
+            }
+            visit(c, l.planes[c] + index * 64);
+        }
+    }
+}
+
+long JpegProgressive::encode(const int16_t* yBlocks, const int16_t* uBlocks, const int16_t* vBlocks,
+                             const int w, const int h, YUVFormat format,
+                             const std::vector<JpegScan> &script) {
+    validateScript(script);
+
+    int sx = 1, sy = 1;
+    if (format == YUVFormat::YUV420) {
+        sx = 2; sy = 2;
+    } else if (format == YUVFormat::YUV422) {
+        sx = 2; sy = 1;
+    }
+    mLayout.planes[0] = yBlocks;
+    mLayout.planes[1] = uBlocks;
+    mLayout.planes[2] = vBlocks;
+    mLayout.sx = sx;
+    mLayout.sy = sy;
+    mLayout.mcuWide = (w + 8 * sx - 1) / (8 * sx);
+    mLayout.mcus = size_t(mLayout.mcuWide) * ((h + 8 * sy - 1) / (8 * sy));
+    mLayout.blocksWide[0] = (w + 7) / 8;
+    mLayout.blocksHigh[0] = (h + 7) / 8;
+    for (int c = 1; c < 3; ++c) {
+        // chrominance is ceil(w / sx) x ceil(h / sy) samples
+        mLayout.blocksWide[c] = ((w + sx - 1) / sx + 7) / 8;
+        mLayout.blocksHigh[c] = ((h + sy - 1) / sy + 7) / 8;
+    }
+
+    mOutput.clear();
+    for (const JpegScan &scan : script) {
+        const bool dc = scan.Ss == 0;
+        const bool huffman = !(dc && scan.Ah > 0); // DC refinement bits are sent raw
+        auto run = [&](auto &out) {
+            ScanCoder<typename std::remove_reference<decltype(out)>::type> coder(out);
+            const int table = scan.components[0] == 0 ? 0 : 1;
+            if (dc && scan.Ah == 0) {
+                codeScan([&](int c, const int16_t* b) { coder.dcFirst(c, b, scan.Al); }, scan);
+            } else if (dc) {
+                codeScan([&](int, const int16_t* b) { coder.dcRefine(b, scan.Al); }, scan);
+            } else if (scan.Ah == 0) {
+                codeScan([&](int, const int16_t* b) { coder.acFirst(table, b, scan.Ss, scan.Se, scan.Al); }, scan);
+            } else {
+                codeScan([&](int, const int16_t* b) { coder.acRefine(table, b, scan.Ss, scan.Se, scan.Al); }, scan);
+            }
+            coder.finish(table);
+        };
+
+        // pass 1: statistics, then one table per table id the scan uses
+        SymbolCounter counter;
+        run(counter);
+        SymbolWriter out;
+        uint8_t tables[2][16 + 256];
+        uint64_t bits = counter.extraBits;
+        size_t headerBytes = JpegIO::MAX_SOS_SIZE;
+        bool used[2] = {false, false};
+        for (int t = 0; t < 2 && huffman; ++t) {
+            for (int s = 0; s < 256 && !used[t]; ++s) used[t] = counter.freq[t][s] != 0;
+            if (!used[t]) continue;
+            HuffmanCodec::buildOptimalTable(counter.freq[t], tables[t]);
+            HuffmanCodec::buildCodes(tables[t], out.codes[t]);
+            for (int s = 0; s < 256; ++s) bits += uint64_t(counter.freq[t][s]) * (out.codes[t][s] >> 16);
+            headerBytes += JpegIO::MAX_DHT_SIZE;
+        }
+
+        // pass 2: tables, scan header and data; the data is at most every byte stuffed
+        const size_t offset = mOutput.size();
+        const size_t dataBytes = 2 * ((bits + 7) / 8) + HuffmanCodec::WRITER_SLACK_BYTES;
+        mOutput.resize(offset + headerBytes + dataBytes);
+        uint8_t* p = mOutput.data() + offset;
+        for (int t = 0; t < 2; ++t) {
+            if (!used[t]) continue;
+            // an optimal table holds at most the 256 symbols it was built from
+            const size_t dhtBytes = JpegIO::writeHuffmanTable(p, tables[t], dc, t);
+            ASSERT(dhtBytes <= JpegIO::MAX_DHT_SIZE, "DHT segment exceeds MAX_DHT_SIZE !");
+            p += dhtBytes;
+        }
+        p += JpegIO::writeScanHeader(p, scan.components, scan.componentCount, scan.Ss, scan.Se, scan.Ah, scan.Al);
+        out.writer.reset(p, mOutput.data() + mOutput.size() - p);
+        run(out);
+        out.writer.flush();
+        if (out.writer.overflow()) {
+            mOutput.clear();
+            return -1;
+        }
+        mOutput.resize(p - mOutput.data() + out.writer.size());
+    }
+    return static_cast<long>(mOutput.size());
+}
@@ -1,6 +1,14 @@
 // ref. :  https://github.com/libjpeg-turbo/libjpeg-turbo/blob/main/jcparam.c
 
 #include "JpegQuant.hpp"
+#include "JpegZigzag.hpp"
+#include "common.hpp"
+
+#include <algorithm>
+
+#ifdef JPEG_X86_SIMD
+#include <immintrin.h>
+#endif
 
 /* These are the sample quantization tables given in Annex K (Clause K.1) of
  * Recommendation ITU-T T.81 (1992) | ISO/IEC 10918-1:1994.
@@ -30,8 +38,10 @@ const int STD_QUANT_TAB_CHROM[64] = {
 
 JpegQuant::JpegQuant(const int quality, const bool force_baseline) {
    this->quality = quality;
+   this->force_baseline = force_baseline;
    this->qtable_lumin = scaledQuality(this->quality, true, force_baseline);
    this->qtable_chrom = scaledQuality(this->quality, false, force_baseline);
+   initReciprocals();
 }
 
 JpegQuant::~JpegQuant() {
@@ -40,8 +50,64 @@ JpegQuant::~JpegQuant() {
 
 void JpegQuant::setQuality(int quality, const bool force_baseline) {
     if (quality == this->quality && force_baseline == this->force_baseline) return;
+    this->quality = quality;
+    this->force_baseline = force_baseline;
     this->qtable_lumin = scaledQuality(quality, true, force_baseline); 
     this->qtable_chrom = scaledQuality(quality, false, force_baseline);
+    initReciprocals();
+}
+
+///
+/// floor(n / q) == (n * recip) >> shift with recip = ceil(2^shift / q) holds for every
+/// n < 2^15 once shift >= 15 + ceil(log2(q)), and n * recip then still fits 32 bits.
+/// n = |coef| + q / 2 stays far below 2^15 for 8-bit samples (|coef| <= 1024).
+///
+void JpegQuant::initReciprocals() {
+    const std::vector<int>* tabs[2] = {&qtable_lumin, &qtable_chrom};
+    for (int t = 0; t < 2; ++t) {
+        for (int k = 0; k < 64; ++k) {
+            const uint32_t q = (*tabs[t])[JpegZigzag::ZIGZAG_INDEX[k]];
+            uint32_t log2q = 0;
+            while ((1u << log2q) < q) ++log2q;
+            const uint32_t shift = 15 + log2q;
+            mRecip[t][k] = static_cast<uint32_t>(((1ull << shift) + q - 1) / q);
+            mRound[t][k] = q >> 1;
+            mShift[t][k] = shift;
+        }
+    }
+    initReciprocals16();
+}
+
+///
+/// 16-bit variant of the reciprocals for the AVX2 kernel (libjpeg-turbo's
+/// compute_reciprocal): the coefficient is scaled by 8 and divided by 8q, so even
+/// q = 1 gets a reciprocal and a scale that fit 16 bits. Exact for |x| < 4096 and
+/// q < 4096; larger q round every 8-bit coefficient to 0, as does q = 4095. The
+/// tables are in zigzag order, as the kernel quantizes the already permuted block.
+///
+void JpegQuant::initReciprocals16() {
+    const std::vector<int>* tabs[2] = {&qtable_lumin, &qtable_chrom};
+    for (int t = 0; t < 2; ++t) {
+        for (int k = 0; k < 64; ++k) {
+            const uint32_t d = 8 * static_cast<uint32_t>(std::min((*tabs[t])[JpegZigzag::ZIGZAG_INDEX[k]], 4095));
+            int r = 16;
+            while ((2u << (r - 16)) <= d) ++r; // r = 16 + floor(log2(d))
+            uint64_t recip = (1ull << r) / d;
+            const uint64_t rem = (1ull << r) % d;
+            uint32_t corr = d / 2;
+            if (rem == 0) { // power of two, the reciprocal would need 17 bits
+                recip >>= 1;
+                --r;
+            } else if (rem <= d / 2) {
+                ++corr;
+            } else {
+                ++recip;
+            }
+            mRecip16[t][k] = static_cast<uint16_t>(recip);
+            mCorr16[t][k] = static_cast<uint16_t>(corr);
+            mScale16[t][k] = static_cast<uint16_t>(1u << (32 - r));
+        }
+    }
 }
 
 std::vector<int> JpegQuant::scaledQuality(int quality, const bool luminance, const bool force_baseline) {
@@ -77,9 +143,101 @@ std::vector<int> JpegQuant::scaledQuality(int quality, const bool luminance, con
     return new_qtable;
 }
 
-void JpegQuant::quantEncode8x8(int *data8x8, const bool luminance) {
-    for (int i = 0; i < 64; i++) {
-        int temp = luminance ? this->qtable_lumin[i] : this->qtable_chrom[i];
-        data8x8[i] /= temp;
+#ifdef JPEG_X86_SIMD
+namespace {
+///
+/// vpshufb masks of the zigzag permutation: a block is 4 vectors of two rows each,
+/// output vector j gathers its 16 coefficients from the input vectors v[i] (source i)
+/// and from their lane-swapped copies (source 4 + i), one masked shuffle per source
+///
+struct ZigzagShuffle {
+    alignas(32) int8_t mask[4][8][32];
+
+    ZigzagShuffle() {
+        for (int j = 0; j < 4; ++j) {
+            for (int s = 0; s < 8; ++s) {
+                for (int b = 0; b < 32; ++b) mask[j][s][b] = -128; // zero the byte
+            }
+            for (int lane = 0; lane < 2; ++lane) {
+                for (int p = 0; p < 8; ++p) {
+                    const int n = JpegZigzag::ZIGZAG_INDEX[16 * j + 8 * lane + p];
+                    const int row = n / 8, col = n % 8;
+                    // v[row / 2] holds the row in lane row % 2, its swapped copy in the other lane
+                    int8_t* m = mask[j][(row % 2 == lane ? 0 : 4) + row / 2] + 16 * lane + 2 * p;
+                    m[0] = int8_t(2 * col);
+                    m[1] = int8_t(2 * col + 1);
+                }
+            }
+        }
+    }
+};
+const ZigzagShuffle ZIGZAG_SHUFFLE;
+
+JPEG_TARGET_AVX2
+inline __m256i pick(const __m256i acc, const __m256i src, const int8_t* mask) {
+    return _mm256_or_si256(acc, _mm256_shuffle_epi8(src, _mm256_load_si256(reinterpret_cast<const __m256i*>(mask))));
+}
+
+///
+/// the block is permuted into zigzag order in registers (the sources each output
+/// vector draws from are listed explicitly, the other masks are all zero), then
+/// quantized with the zigzag-ordered 16-bit tables: two high multiplies replace the
+/// division. Every load happens before the first store, so the kernel runs in place.
+///
+JPEG_TARGET_AVX2
+void quantZigzag8x8AVX2(const int16_t* dct8x8, int16_t* zz8x8,
+                        const uint16_t* recip, const uint16_t* corr, const uint16_t* scale) {
+    __m256i src[8];
+    for (int i = 0; i < 4; ++i) {
+        src[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dct8x8 + i * 16));
+        src[4 + i] = _mm256_permute2x128_si256(src[i], src[i], 0x01);
+    }
+    const int8_t (*m)[8][32] = ZIGZAG_SHUFFLE.mask;
+    __m256i zz[4];
+    const __m256i zero = _mm256_setzero_si256();
+    zz[0] = pick(pick(pick(pick(pick(zero, src[0], m[0][0]), src[1], m[0][1]),
+                           src[4], m[0][4]), src[5], m[0][5]), src[6], m[0][6]);
+    zz[1] = pick(pick(pick(pick(pick(pick(pick(zero, src[0], m[1][0]), src[1], m[1][1]), src[2], m[1][2]),
+                                src[3], m[1][3]), src[4], m[1][4]), src[5], m[1][5]), src[6], m[1][6]);
+    zz[2] = pick(pick(pick(pick(pick(pick(pick(zero, src[0], m[2][0]), src[1], m[2][1]), src[2], m[2][2]),
+                                src[3], m[2][3]), src[5], m[2][5]), src[6], m[2][6]), src[7], m[2][7]);
+    zz[3] = pick(pick(pick(pick(pick(zero, src[2], m[3][2]), src[3], m[3][3]),
+                           src[5], m[3][5]), src[6], m[3][6]), src[7], m[3][7]);
+    for (int i = 0; i < 4; ++i) {
+        const __m256i v = zz[i];
+        __m256i n = _mm256_add_epi16(_mm256_slli_epi16(_mm256_abs_epi16(v), 3),
+                                     _mm256_loadu_si256(reinterpret_cast<const __m256i*>(corr + i * 16)));
+        n = _mm256_mulhi_epu16(n, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(recip + i * 16)));
+        n = _mm256_mulhi_epu16(n, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(scale + i * 16)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(zz8x8 + i * 16), _mm256_sign_epi16(n, v));
+    }
+}
+} // namespace
+#endif
+
+void JpegQuant::quantZigzag8x8(const int16_t* dct8x8, int16_t* zz8x8, const bool luminance) const {
+    const int t = luminance ? 0 : 1;
+    int16_t tmp[64];
+    for (int k = 0; k < 64; k++) {
+        const int c = dct8x8[JpegZigzag::ZIGZAG_INDEX[k]];
+        const uint32_t n = static_cast<uint32_t>(c < 0 ? -c : c) + mRound[t][k];
+        const int q = static_cast<int>((n * mRecip[t][k]) >> mShift[t][k]);
+        tmp[k] = static_cast<int16_t>(c < 0 ? -q : q);
+    }
+    for (int k = 0; k < 64; k++) zz8x8[k] = tmp[k];
+}
+
+void JpegQuant::quantZigzagBlocks(const int16_t* dct, int16_t* zz, const size_t nblocks, const bool luminance) const {
+#ifdef JPEG_X86_SIMD
+    if (cpuSupportsAVX2()) {
+        const int t = luminance ? 0 : 1;
+        for (size_t i = 0; i < nblocks; ++i) {
+            quantZigzag8x8AVX2(dct + i * 64, zz + i * 64, mRecip16[t], mCorr16[t], mScale16[t]);
+        }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < nblocks; ++i) {
+        quantZigzag8x8(dct + i * 64, zz + i * 64, luminance);
     }
 }
@@ -0,0 +1,88 @@
+#include "JpegSink.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+
+FdSink::FdSink(int fd): mFd(fd), mOwned(false), mBytes(0) {
+}
+
+FdSink::FdSink(const char* path): mFd(-1), mOwned(true), mBytes(0) {
+    mFd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mFd < 0) {
+        mError = std::string("cannot open ") + path + ": " + std::strerror(errno);
+    }
+}
+
+FdSink::~FdSink() {
+    close();
+}
+
+bool FdSink::close() {
+    if (!mOwned || mFd < 0) {
+        return true;
+    }
+    int ret = ::close(mFd);
+    mFd = -1;
+    if (ret != 0) {
+        mError = std::string("close: ") + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool FdSink::write(const struct iovec* iov_in, int iovcnt) {
+    if (mFd < 0) {
+        if (mError.empty()) mError = "file descriptor is not open";
+        return false;
+    }
+    std::vector<struct iovec> iov(iov_in, iov_in + iovcnt);
+    struct iovec* cur = iov.data();
+    int left = iovcnt;
+    while (left > 0) {
+        ssize_t n = ::writev(mFd, cur, left < IOV_MAX ? left : IOV_MAX);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            mError = std::string("writev: ") + std::strerror(errno);
+            return false;
+        }
+        mBytes += n;
+        // skip what was written, a partial write continues inside a buffer
+        while (left > 0 && size_t(n) >= cur->iov_len) {
+            n -= cur->iov_len;
+            ++cur;
+            --left;
+        }
+        if (left > 0) {
+            cur->iov_base = static_cast<char*>(cur->iov_base) + n;
+            cur->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+bool MemorySink::write(const struct iovec* iov, int iovcnt) {
+    size_t total = mData.size();
+    for (int i = 0; i < iovcnt; ++i) total += iov[i].iov_len;
+    // one reallocation for all pieces, growing geometrically: streaming writes one MCU row at a time
+    if (total > mData.capacity()) mData.reserve(std::max(total, 2 * mData.capacity()));
+    for (int i = 0; i < iovcnt; ++i) {
+        const uint8_t* p = static_cast<const uint8_t*>(iov[i].iov_base);
+        mData.insert(mData.end(), p, p + iov[i].iov_len);
+    }
+    return true;
+}
+
+bool CallbackSink::write(const struct iovec* iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; ++i) {
+        if (iov[i].iov_len == 0) continue;
+        if (!mCallback(static_cast<const uint8_t*>(iov[i].iov_base), iov[i].iov_len)) {
+            mError = "output callback failed";
+            return false;
+        }
+    }
+    return true;
+}
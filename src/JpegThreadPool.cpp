@@ -0,0 +1,108 @@
+#include "JpegThreadPool.hpp"
+
+#include <algorithm>
+
+// index of the pool worker running on this thread, -1 outside of any pool
+static thread_local const JpegThreadPool* tlsPool = nullptr;
+static thread_local int tlsWorker = -1;
+
+JpegThreadPool::JpegThreadPool(int threads): mQueued(0), mPending(0), mNext(0), mStop(false) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < threads; ++i) {
+        mQueues.emplace_back(new Queue());
+    }
+    for (int i = 0; i < threads; ++i) {
+        mWorkers.emplace_back(&JpegThreadPool::workerLoop, this, i);
+    }
+}
+
+JpegThreadPool::~JpegThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mWakeUp.notify_all();
+    for (auto &worker : mWorkers) worker.join();
+}
+
+void JpegThreadPool::submit(Task task) {
+    const int index = (tlsPool == this) ? tlsWorker
+                                        : static_cast<int>(mNext++ % mQueues.size());
+    mPending++;
+    {
+        // counted first, so mQueued never drops below the tasks still in the deques
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueued++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mQueues[index]->mutex);
+        mQueues[index]->tasks.push_back(std::move(task));
+    }
+    mWakeUp.notify_one();
+}
+
+void JpegThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mIdle.wait(lock, [this] { return mPending == 0; });
+    if (mError) {
+        std::exception_ptr error = mError;
+        mError = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+bool JpegThreadPool::popLocal(const int index, Task &task) {
+    Queue &queue = *mQueues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool JpegThreadPool::steal(const int index, Task &task) {
+    const int n = static_cast<int>(mQueues.size());
+    for (int k = 1; k < n; ++k) {
+        Queue &queue = *mQueues[(index + k) % n];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void JpegThreadPool::workerLoop(const int index) {
+    tlsPool = this;
+    tlsWorker = index;
+    for (;;) {
+        {
+            // sleep until a task is queued anywhere
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWakeUp.wait(lock, [this] { return mStop || mQueued > 0; });
+            if (mQueued == 0) return; // stopping and nothing left
+        }
+        Task task;
+        if (!popLocal(index, task) && !steal(index, task)) {
+            continue; // another worker took it first
+        }
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQueued--;
+        }
+        try {
+            task(index);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (!mError) mError = std::current_exception();
+        }
+        if (--mPending == 0) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mIdle.notify_all();
+        }
+    }
+}
@@ -4,13 +4,24 @@
 #include <unordered_map>
 #include <memory>
 
+#include <sys/stat.h>
+
 #include "JpegEncoder.hpp"
+#include "JpegBatch.hpp"
 
 struct Arguments {
     std::string inputFileName;
     std::string outputFileName;
     int quality;
     std::string format;
+    std::string mode;
+    int restartRows;
+    int threads;
+    bool optimize;
+    bool progressive;
+    // batch mode: positional input files and/or -b directory or manifest
+    std::vector<std::string> inputs;
+    std::string batch;
 };
 
 Arguments parseArguments(int argc, const char** argv) {
@@ -19,6 +30,11 @@ Arguments parseArguments(int argc, const char** argv) {
     // Default values
     args.quality = 50;
     args.format = "444";
+    args.mode = "full";
+    args.restartRows = 0;
+    args.threads = 1;
+    args.optimize = false;
+    args.progressive = false;
 
     // Map of option names to their values
     std::unordered_map<std::string, std::string> options;
@@ -37,26 +53,26 @@ Arguments parseArguments(int argc, const char** argv) {
             std::string optValue = argv[i];
             options[optName] = optValue;
         } else {
-            // Found an argument (not an option)
-            // This is an error if we've already found an input file name
-            if (args.inputFileName != "") {
-                throw std::runtime_error("Multiple input file names specified.");
-            }
-            args.inputFileName = arg;
+            // Found an argument (not an option): an input of the batch
+            args.inputs.push_back(arg);
         }
     }
+    if (options.count("b")) {
+        args.batch = options["b"];
+    }
+    const bool batchMode = !args.batch.empty() || !args.inputs.empty();
 
     // Validate the options and their values
     if (options.count("i")) {
         args.inputFileName  = options["i"];
-    } else {
-        throw std::runtime_error("Input file name not specified. Usage example: ./jpeg_encoder -i xx.png -o xxx.jpg -q 50 -f 420, where -q is the quality range [1,100], -f is the yuvformat [444, 420, 4422]");
+    } else if (!batchMode) {
+        throw std::runtime_error("Input file name not specified. Usage example: ./jpeg_encoder -i xx.png -o xxx.jpg -q 50 -f 420, where -q is the quality range [1,100], -f is the yuvformat [444, 420, 4422], -m is the mode [full, stream; batch: full, pipeline], -r is the restart interval in MCU rows (0: none), -t is the number of entropy coding threads (0: all cores), -O 1 optimizes the Huffman tables per image, -p 1 writes a progressive JPEG (full mode). Batch mode: ./jpeg_encoder -b <directory|manifest> -o <output directory> [a.png b.png ...], where every manifest line is 'input [output [quality [format]]]' and -t is the number of worker threads (default: all cores)");
     } 
 
     if (options.count("o")) {
         args.outputFileName = options["o"];
     } else {
-        throw std::runtime_error("Output file name not specified.");
+        throw std::runtime_error(batchMode ? "Output directory not specified." : "Output file name not specified.");
     }
 
     if (options.count("q")) {
@@ -75,8 +91,50 @@ Arguments parseArguments(int argc, const char** argv) {
         args.format = format;
     }
 
+    if (options.count("m")) {
+        std::string mode = options["m"];
+        if (mode != "full" && mode != "stream" && mode != "pipeline") {
+            throw std::runtime_error("Invalid value for mode.");
+        }
+        args.mode = mode;
+    }
+
+    if (options.count("r")) {
+        try {
+            args.restartRows = std::stoi(options["r"]);
+        } catch (...) {
+            throw std::runtime_error("Invalid value for restart interval.");
+        }
+    }
+
+    if (options.count("t")) {
+        try {
+            args.threads = std::stoi(options["t"]);
+        } catch (...) {
+            throw std::runtime_error("Invalid value for threads.");
+        }
+    } else if (batchMode) {
+        args.threads = 0;
+    }
+
+    if (options.count("O")) {
+        std::string optimize = options["O"];
+        if (optimize != "0" && optimize != "1") {
+            throw std::runtime_error("Invalid value for Huffman optimization.");
+        }
+        args.optimize = optimize == "1";
+    }
+
+    if (options.count("p")) {
+        std::string progressive = options["p"];
+        if (progressive != "0" && progressive != "1") {
+            throw std::runtime_error("Invalid value for progressive.");
+        }
+        args.progressive = progressive == "1";
+    }
+
     // Validate that we have an input file name
-    if (args.inputFileName == "") {
+    if (!batchMode && args.inputFileName == "") {
         throw std::runtime_error("Input file name not specified.");
     }
 
@@ -85,17 +143,54 @@ Arguments parseArguments(int argc, const char** argv) {
 
 
 
+static bool isDirectory(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static int runBatch(const Arguments &args) {
+    if (args.mode != "full" && args.mode != "pipeline") {
+        throw std::runtime_error("batch mode supports the full and pipeline modes only");
+    }
+    const YUVFormat format = JpegBatch::parseFormat(args.format);
+    std::vector<JpegJob> jobs = JpegBatch::fromInputs(args.inputs, args.outputFileName, args.quality, format);
+    if (!args.batch.empty()) {
+        std::vector<JpegJob> more = isDirectory(args.batch)
+            ? JpegBatch::fromDirectory(args.batch, args.outputFileName, args.quality, format)
+            : JpegBatch::fromManifest(args.batch, args.outputFileName, args.quality, format);
+        jobs.insert(jobs.end(), more.begin(), more.end());
+    }
+
+    JpegBatch batch(args.threads);
+    batch.setRestartInterval(args.restartRows);
+    batch.setOptimizeHuffman(args.optimize);
+    batch.setProgressive(args.progressive);
+    batch.setPipeline(args.mode == "pipeline");
+    JpegBatchStats stats = batch.run(jobs);
+
+    const double seconds = stats.seconds > 0 ? stats.seconds : 1e-9;
+    std::cout << "batch: " << stats.images << " images encoded, " << stats.failed << " failed" << std::endl;
+    std::cout << "time: " << stats.seconds << " s, " << stats.images / seconds << " images/s, "
+              << stats.pixels / seconds / 1e6 << " MPixel/s, "
+              << stats.outputBytes / seconds / (1 << 20) << " MiB/s written" << std::endl;
+    return stats.failed == 0 ? 0 : 1;
+}
+
 int main(int argc, const char** argv) {
 
     try {
         Arguments args = parseArguments(argc, argv);
+        if (!args.batch.empty() || !args.inputs.empty()) {
+            return runBatch(args);
+        }
         std::cout << "Input image: " << args.inputFileName << std::endl;
         std::cout << "Output jpeg: " << args.outputFileName << std::endl;
         std::cout << "Quality: " << args.quality << std::endl;
         std::cout << "YUVFormat: " << args.format << std::endl;
 
-        // Read a RGB image
-        Image<uint8_t> image(args.inputFileName.c_str());
+        // Read a RGB image, encoded in place from the decoder's buffer
+        StbImage decoded(args.inputFileName.c_str());
+        ImageView<uint8_t> image = decoded.view();
         const int width = image.cols();
         const int height = image.rows();
         std::cout << "image width:" << width << " height:" << height << std::endl;
@@ -107,7 +202,14 @@ int main(int argc, const char** argv) {
 
         std::cout<<"encoded JPEG image to "<< args.format << std::endl;
         std::shared_ptr<JpegEncoder> jpegEncoder = std::make_shared<JpegEncoder>(args.outputFileName);
-        jpegEncoder->encodeRGB(image, args.quality, format);
+        jpegEncoder->setRestartInterval(args.restartRows, args.threads);
+        jpegEncoder->setOptimizeHuffman(args.optimize);
+        jpegEncoder->setProgressive(args.progressive);
+        if (args.mode == "stream") {
+            jpegEncoder->encodeRGBStreaming(image, args.quality, format);
+        } else {
+            jpegEncoder->encodeRGB(image, args.quality, format);
+        }
     } catch (const std::exception& ex) {
         std::cerr << "Error: " << ex.what() << std::endl;
         return 1;
@@ -3,9 +3,18 @@
 
 #include "image.hpp"
 
+#include <stdexcept>
+#include <string>
+
 
 uint8_t* read_stb_rgb(const char* file, int &width, int &height, int &channels) {
     return stbi_load(file, &width, &height, &channels, STBI_rgb);
 }
 
-
+StbImage::StbImage(const char* filename): _data(nullptr), _rows(0), _cols(0) {
+    int channels;
+    _data = read_stb_rgb(filename, _cols, _rows, channels);
+    if (!_data) {
+        throw std::runtime_error(std::string("cannot decode image: ") + stbi_failure_reason());
+    }
+}
@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <random>
+
+#include "JpegBitWriter.hpp"
+using namespace std;
+
+// bit-at-a-time reference with the same stuffing and 1-padding rules
+static std::vector<uint8_t> reference_bits(const std::vector<std::pair<uint32_t, int>> &codes) {
+  std::vector<uint8_t> out;
+  int acc = 0, n = 0;
+  auto put = [&](int bit) {
+    acc = (acc << 1) | bit;
+    if (++n == 8) {
+      out.push_back(acc);
+      if (acc == 0xFF) out.push_back(0x00);
+      acc = 0; n = 0;
+    }
+  };
+  for (auto &c : codes)
+    for (int i = c.second - 1; i >= 0; --i) put((c.first >> i) & 1);
+  while (n) put(1);
+  return out;
+}
+
+TEST(JpegBitWriterTest, matches_reference) {
+  std::mt19937 gen(2023);
+  for (int round = 0; round < 50; ++round) {
+    std::vector<std::pair<uint32_t, int>> codes;
+    const int count = gen() % 2000;
+    for (int i = 0; i < count; ++i) {
+      const int n = gen() % 33;
+      // bias towards all-ones codes so that stuffing is exercised
+      uint32_t bits = (gen() % 4 == 0) ? 0xFFFFFFFFu : gen();
+      bits = n == 32 ? bits : bits & ((1u << n) - 1);
+      codes.emplace_back(bits, n);
+    }
+    std::vector<uint8_t> expected = reference_bits(codes);
+    std::vector<uint8_t> buf(expected.size() + 64);
+    JpegBitWriter writer(buf.data(), buf.size());
+    for (auto &c : codes) writer.putBits(c.first, c.second);
+    const size_t size = writer.flush();
+    ASSERT_FALSE(writer.overflow());
+    ASSERT_EQ(size, expected.size());
+    for (size_t i = 0; i < size; ++i) ASSERT_EQ(buf[i], expected[i]) << "round " << round << " byte " << i;
+  }
+}
+
+TEST(JpegBitWriterTest, overflow) {
+  std::vector<uint8_t> buf(20);
+  JpegBitWriter writer(buf.data(), buf.size());
+  for (int i = 0; i < 100; ++i) writer.putBits(0xFFFF, 16);
+  writer.flush();
+  ASSERT_TRUE(writer.overflow());
+  ASSERT_LE(writer.size(), buf.size());
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <random>
+#include <cmath>
+
+#include "JpegColor.hpp"
+using namespace std;
+
+// the dispatched (SIMD) conversion must be bit-exact with the scalar reference,
+// including the tails that are not a multiple of the vector width
+TEST(JpegColorTest, rgbRowToYCbCr_matches_scalar) {
+  std::mt19937 gen(5425);
+  std::uniform_int_distribution<int> dis(0, 255);
+  for (int n : {1, 15, 16, 17, 31, 32, 33, 257, 6000}) {
+    std::vector<uint8_t> rgb(3 * n);
+    for (auto &v : rgb) v = dis(gen);
+    std::vector<uint8_t> fast(3 * n), ref(3 * n);
+    JpegColor::rgbRowToYCbCr(rgb.data(), fast.data(), fast.data() + n, fast.data() + 2 * n, n);
+    JpegColor::rgbRowToYCbCrScalar(rgb.data(), ref.data(), ref.data() + n, ref.data() + 2 * n, n);
+    for (int i = 0; i < 3 * n; ++i) ASSERT_EQ(fast[i], ref[i]) << "n=" << n << " i=" << i;
+  }
+}
+
+TEST(JpegColorTest, rgbToYUV444_accuracy) {
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<int> dis(0, 255);
+  Image<uint8_t> rgb(7, 45, 3);
+  for (size_t i = 0; i < rgb.numel(); ++i) rgb.data()[i] = dis(gen);
+  Image<uint8_t> yuv = JpegColor::rgbToYUV444(rgb);
+  ASSERT_EQ(yuv.rows(), rgb.rows());
+  ASSERT_EQ(yuv.cols(), rgb.cols());
+  for (size_t y = 0; y < rgb.rows(); ++y) {
+    for (size_t x = 0; x < rgb.cols(); ++x) {
+      const float r = rgb(y, x, 0), g = rgb(y, x, 1), b = rgb(y, x, 2);
+      ASSERT_LE(std::fabs( 0.299f * r + 0.587f * g + 0.114f * b - yuv(y, x, 0)), 1.0f);
+      ASSERT_LE(std::fabs(-0.168736f * r - 0.331264f * g + 0.5f * b + 128 - yuv(y, x, 1)), 1.0f);
+      ASSERT_LE(std::fabs( 0.5f * r - 0.418688f * g - 0.081312f * b + 128 - yuv(y, x, 2)), 1.0f);
+    }
+  }
+}
+
+// the fused stage must agree with convert-then-sample on the full YUV image,
+// with pixels outside the image replicated from the nearest edge
+TEST(JpegColorTest, rgbToBlocks_matches_two_pass) {
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<int> dis(0, 255);
+  Image<uint8_t> rgb(21, 37, 3);
+  for (size_t i = 0; i < rgb.numel(); ++i) rgb.data()[i] = dis(gen);
+  Image<uint8_t> yuv = JpegColor::rgbToYUV444(rgb);
+  auto at = [&](int y, int x, int c) {
+    return int(yuv(std::min<int>(y, yuv.rows() - 1), std::min<int>(x, yuv.cols() - 1), c));
+  };
+
+  const int factors[3][2] = {{1, 1}, {2, 1}, {2, 2}};
+  for (auto &f : factors) {
+    const int sx = f[0], sy = f[1];
+    const int bw = 8 * sx, bh = 8 * sy;
+    const int nw = (rgb.cols() + bw - 1) / bw, nh = (rgb.rows() + bh - 1) / bh;
+    std::vector<uint8_t> yb, ub, vb;
+    JpegColor::rgbToBlocks(rgb, yb, ub, vb, bw, bh, sx, sy);
+    ASSERT_EQ(yb.size(), size_t(64 * nw * nh * sx * sy));
+    ASSERT_EQ(ub.size(), size_t(64 * nw * nh));
+
+    for (int by = 0; by < nh; ++by) {
+      for (int bx = 0; bx < nw; ++bx) {
+        const int mb = by * nw + bx;
+        for (int k = 0; k < sx * sy; ++k) {
+          for (int i = 0; i < 64; ++i) {
+            int y = by * bh + (k / sx) * 8 + i / 8, x = bx * bw + (k % sx) * 8 + i % 8;
+            ASSERT_EQ(yb[(mb * sx * sy + k) * 64 + i], at(y, x, 0));
+          }
+        }
+        for (int i = 0; i < 64; ++i) {
+          for (int c = 1; c < 3; ++c) {
+            int sum = 0;
+            for (int j = 0; j < sy; ++j)
+              for (int q = 0; q < sx; ++q)
+                sum += at(by * bh + (i / 8) * sy + j, bx * bw + (i % 8) * sx + q, c);
+            const uint8_t got = (c == 1 ? ub : vb)[mb * 64 + i];
+            ASSERT_EQ(got, (sum + sx * sy / 2) / (sx * sy));
+          }
+        }
+      }
+    }
+  }
+}
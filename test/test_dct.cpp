@@ -0,0 +1,54 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <random>
+#include <cmath>
+
+#include "JpegDCT.hpp"
+using namespace std;
+
+static void reference_fdct(const uint8_t* block, double* out) {
+  const double PI = std::acos(-1.0);
+  for (int u = 0; u < 8; ++u) {
+    for (int v = 0; v < 8; ++v) {
+      double sum = 0;
+      for (int y = 0; y < 8; ++y)
+        for (int x = 0; x < 8; ++x)
+          sum += (block[y * 8 + x] - 128.0) * std::cos((2 * y + 1) * u * PI / 16) * std::cos((2 * x + 1) * v * PI / 16);
+      const double cu = u ? 1.0 : std::sqrt(0.5), cv = v ? 1.0 : std::sqrt(0.5);
+      out[u * 8 + v] = 0.25 * cu * cv * sum;
+    }
+  }
+}
+
+static std::vector<uint8_t> random_blocks(const int n, const unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> dis(0, 255);
+  std::vector<uint8_t> blocks(64 * n);
+  for (auto &v : blocks) v = dis(gen);
+  // saturated blocks exercise the extremes of the fixed-point ranges
+  for (int i = 0; i < 64; ++i) { blocks[i] = 255; blocks[64 + i] = 0; blocks[128 + i] = (i & 1) ? 255 : 0; }
+  return blocks;
+}
+
+TEST(JpegDCTTest, scalar_accuracy) {
+  const int n = 64;
+  std::vector<uint8_t> blocks = random_blocks(n, 3);
+  int16_t dct[64];
+  double ref[64];
+  for (int b = 0; b < n; ++b) {
+    JpegDCT::fdct8x8Scalar(blocks.data() + b * 64, dct);
+    reference_fdct(blocks.data() + b * 64, ref);
+    for (int i = 0; i < 64; ++i) ASSERT_LE(std::fabs(dct[i] - ref[i]), 1.0) << "block " << b << " coef " << i;
+  }
+}
+
+// fdctBlocks runs 8 blocks at a time on SIMD, the tail falls back to scalar
+TEST(JpegDCTTest, fdctBlocks_matches_scalar) {
+  for (int n : {1, 7, 8, 9, 35}) {
+    std::vector<uint8_t> blocks = random_blocks(std::max(n, 3), n);
+    std::vector<int16_t> fast(64 * n), ref(64 * n);
+    JpegDCT::fdctBlocks(blocks.data(), fast.data(), n);
+    for (int b = 0; b < n; ++b) JpegDCT::fdct8x8Scalar(blocks.data() + b * 64, ref.data() + b * 64);
+    for (int i = 0; i < 64 * n; ++i) ASSERT_EQ(fast[i], ref[i]) << "n=" << n << " i=" << i;
+  }
+}
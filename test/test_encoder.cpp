@@ -0,0 +1,336 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+
+#include "JpegEncoder.hpp"
+#include "../3rdparty/stb_image.h"
+using namespace std;
+
+static Image<uint8_t> gradient_image(const int rows, const int cols) {
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<int> noise(-8, 8);
+  Image<uint8_t> rgb(rows, cols, 3);
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j) {
+      uint8_t* px = rgb.data() + (size_t(i) * cols + j) * 3;
+      px[0] = std::max(0, std::min(255, i * 255 / rows + noise(gen)));
+      px[1] = std::max(0, std::min(255, j * 255 / cols + noise(gen)));
+      px[2] = std::max(0, std::min(255, 128 + noise(gen)));
+    }
+  }
+  return rgb;
+}
+
+static std::vector<uint8_t> read_file(const char* path) {
+  std::vector<uint8_t> bytes;
+  FILE* fp = fopen(path, "rb");
+  if (!fp) return bytes;
+  int c;
+  while ((c = fgetc(fp)) != EOF) bytes.push_back(uint8_t(c));
+  fclose(fp);
+  return bytes;
+}
+
+// RGB pixels of a JPEG decoded by the in-tree stb_image, empty if it fails to decode
+static std::vector<uint8_t> decode_jpeg(const std::vector<uint8_t> &jpeg, const int rows, const int cols) {
+  int w = 0, h = 0, n = 0;
+  uint8_t* pixels = stbi_load_from_memory(jpeg.data(), int(jpeg.size()), &w, &h, &n, 3);
+  std::vector<uint8_t> rgb;
+  if (pixels && w == cols && h == rows) rgb.assign(pixels, pixels + size_t(w) * h * 3);
+  stbi_image_free(pixels);
+  return rgb;
+}
+
+static double psnr(const std::vector<uint8_t> &decoded, const Image<uint8_t> &rgb) {
+  double sse = 0;
+  for (size_t i = 0; i < decoded.size(); ++i) {
+    const double d = double(decoded[i]) - rgb.data()[i];
+    sse += d * d;
+  }
+  return 10 * std::log10(255.0 * 255.0 * decoded.size() / std::max(sse, 1e-9));
+}
+
+// the in-memory result must be the same file that encodeRGB writes
+TEST(JpegEncoderTest, encodeToBuffer_matches_file) {
+  const char* path = "test_encoder_tmp.jpg";
+  for (YUVFormat format : {YUVFormat::YUV444, YUVFormat::YUV420, YUVFormat::YUV422}) {
+    for (int restart : {0, 1}) {
+      Image<uint8_t> rgb = gradient_image(37, 53);
+      JpegEncoder fileEncoder(path);
+      fileEncoder.setRestartInterval(restart);
+      fileEncoder.encodeRGB(rgb, 75, format);
+      std::vector<uint8_t> expected = read_file(path);
+      std::remove(path);
+
+      JpegEncoder encoder;
+      encoder.setRestartInterval(restart);
+      std::vector<uint8_t> jpeg = encoder.encodeToBuffer(rgb, 75, format);
+      ASSERT_FALSE(jpeg.empty());
+      ASSERT_EQ(jpeg, expected);
+
+      std::vector<uint8_t> dst(jpeg.size());
+      ASSERT_EQ(encoder.encodeToBuffer(rgb, 75, format, dst.data(), dst.size()), (long)jpeg.size());
+      ASSERT_EQ(dst, jpeg);
+      ASSERT_EQ(encoder.encodeToBuffer(rgb, 75, format, dst.data(), dst.size() - 1), -1);
+
+      // a worst-case buffer takes the scan in place, the file must not change
+      std::vector<uint8_t> bounded(JpegEncoder::maxEncodedSize(rgb.cols(), rgb.rows(), format, restart));
+      ASSERT_EQ(encoder.encodeToBuffer(rgb, 75, format, bounded.data(), bounded.size()), (long)jpeg.size());
+      bounded.resize(jpeg.size());
+      ASSERT_EQ(bounded, jpeg);
+    }
+  }
+}
+
+// every sink receives the same file, in full and streaming mode
+TEST(JpegEncoderTest, sinks_match_buffer) {
+  Image<uint8_t> rgb = gradient_image(45, 29);
+  for (YUVFormat format : {YUVFormat::YUV444, YUVFormat::YUV420}) {
+    JpegEncoder encoder;
+    std::vector<uint8_t> expected = encoder.encodeToBuffer(rgb, 90, format);
+
+    MemorySink memory;
+    encoder.encodeRGB(rgb, 90, format, memory);
+    ASSERT_EQ(memory.data(), expected);
+
+    MemorySink streamed;
+    encoder.encodeRGBStreaming(rgb, 90, format, streamed);
+    ASSERT_EQ(streamed.data(), expected);
+
+    std::vector<uint8_t> collected;
+    CallbackSink callback([&](const uint8_t* data, size_t size) {
+      collected.insert(collected.end(), data, data + size);
+      return true;
+    });
+    encoder.encodeRGB(rgb, 90, format, callback);
+    ASSERT_EQ(collected, expected);
+  }
+}
+
+// many small writes reallocate the memory sink a logarithmic number of times
+TEST(JpegEncoderTest, memory_sink_grows_geometrically) {
+  MemorySink memory;
+  uint8_t bytes[3] = {1, 2, 3};
+  struct iovec iov[2] = {{bytes, 1}, {bytes + 1, 2}};
+  int reallocations = 0;
+  for (int i = 0; i < 10000; ++i) {
+    const size_t capacity = memory.data().capacity();
+    ASSERT_TRUE(memory.write(iov, 2));
+    reallocations += memory.data().capacity() != capacity;
+  }
+  ASSERT_EQ(memory.data().size(), size_t(30000));
+  ASSERT_LT(reallocations, 20);
+}
+
+TEST(JpegEncoderTest, sink_errors_are_reported) {
+  Image<uint8_t> rgb = gradient_image(16, 16);
+  JpegEncoder encoder;
+  CallbackSink failing([](const uint8_t*, size_t) { return false; });
+  ASSERT_THROW(encoder.encodeRGB(rgb, 50, YUVFormat::YUV444, failing), std::runtime_error);
+  ASSERT_FALSE(failing.error().empty());
+
+  JpegEncoder missing("no_such_directory/out.jpg");
+  ASSERT_THROW(missing.encodeRGB(rgb, 50, YUVFormat::YUV444), std::runtime_error);
+}
+
+// the coefficient planes are 16-bit and start on a SIMD vector boundary
+TEST(JpegEncoderTest, coefficients_are_aligned_int16) {
+  Image<uint8_t> rgb = gradient_image(37, 53);
+  JpegEncoder encoder;
+  encoder.setVerbose(false);
+  for (YUVFormat format : {YUVFormat::YUV444, YUVFormat::YUV420, YUVFormat::YUV422}) {
+    JpegCoefficients c;
+    encoder.transformRGB(rgb, 90, format, c);
+    for (const auto *plane : {&c.y, &c.u, &c.v}) {
+      ASSERT_FALSE(plane->empty());
+      ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(plane->data()) % JPEG_SIMD_ALIGN);
+      ASSERT_EQ(0u, plane->size() % 64);
+    }
+  }
+}
+
+// one context encoding a sequence of images with changing settings produces the
+// same files as a fresh encoder per image
+TEST(JpegEncoderTest, reused_context_matches_fresh) {
+  JpegEncoder context;
+  context.setVerbose(false);
+  struct Step { int rows, cols, quality; YUVFormat format; bool optimize; bool streaming; };
+  const Step steps[] = {
+    {37, 53, 75, YUVFormat::YUV420, false, false},
+    {37, 53, 75, YUVFormat::YUV420, true, false},
+    {64, 96, 90, YUVFormat::YUV444, false, true},
+    {16, 24, 75, YUVFormat::YUV422, false, false},
+    {37, 53, 30, YUVFormat::YUV420, false, false},
+  };
+  for (const Step &s : steps) {
+    Image<uint8_t> rgb = gradient_image(s.rows, s.cols);
+    JpegEncoder fresh;
+    fresh.setVerbose(false);
+    fresh.setOptimizeHuffman(s.optimize);
+    context.setOptimizeHuffman(s.optimize);
+    MemorySink expected, actual;
+    if (s.streaming) {
+      fresh.encodeRGBStreaming(rgb, s.quality, s.format, expected);
+      context.encodeRGBStreaming(rgb, s.quality, s.format, actual);
+    } else {
+      fresh.encodeRGB(rgb, s.quality, s.format, expected);
+      context.encodeRGB(rgb, s.quality, s.format, actual);
+    }
+    ASSERT_FALSE(expected.data().empty());
+    ASSERT_EQ(actual.data(), expected.data()) << s.rows << "x" << s.cols << " q=" << s.quality;
+  }
+}
+
+// arena allocations are aligned, reserve() merges the blocks of an encode that did
+// not fit into one, and releases memory far above what the next encode needs
+TEST(JpegArenaTest, reserve_merges_and_shrinks) {
+  JpegArena arena;
+  arena.reserve(1000);
+  const size_t sizes[] = {7, 1000, 100000, 3};
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t n : sizes) {
+      uint8_t* p = arena.allocate<uint8_t>(n);
+      ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(p) % JPEG_SIMD_ALIGN);
+      std::memset(p, 0xab, n);
+    }
+    const size_t capacity = arena.capacity();
+    arena.reserve(1000);
+    ASSERT_EQ(capacity, arena.capacity());
+  }
+  size_t total = 0;
+  for (size_t n : sizes) total += JpegArena::footprint<uint8_t>(n);
+  ASSERT_GE(arena.capacity(), total);
+
+  arena.reserve(size_t(64) << 20);
+  ASSERT_EQ(size_t(64) << 20, arena.capacity());
+  arena.reserve(size_t(16) << 20); // within the factor, kept
+  ASSERT_EQ(size_t(64) << 20, arena.capacity());
+  arena.reserve(1000);
+  ASSERT_EQ(size_t(JpegArena::MIN_BLOCK_BYTES), arena.capacity());
+}
+
+// rows with padding and cropped windows are read in place and encode like a
+// contiguous copy of the same pixels
+TEST(JpegEncoderTest, strided_view_matches_contiguous) {
+  const int rows = 37, cols = 53, pad = 13;
+  Image<uint8_t> rgb = gradient_image(rows, cols);
+  std::vector<uint8_t> padded(size_t(rows) * (cols * 3 + pad), 0xee);
+  for (int y = 0; y < rows; ++y)
+    std::memcpy(padded.data() + size_t(y) * (cols * 3 + pad), rgb[y], cols * 3);
+  ImageView<uint8_t> view(padded.data(), rows, cols, 3, cols * 3 + pad);
+
+  JpegEncoder encoder;
+  encoder.setVerbose(false);
+  for (YUVFormat format : {YUVFormat::YUV444, YUVFormat::YUV420}) {
+    ASSERT_EQ(encoder.encodeToBuffer(view, 80, format), encoder.encodeToBuffer(rgb, 80, format));
+    MemorySink stream, full;
+    encoder.encodeRGBStreaming(view, 80, format, stream);
+    encoder.encodeRGB(rgb, 80, format, full);
+    ASSERT_EQ(stream.data(), full.data());
+
+    Image<uint8_t> window(21, 30, 3);
+    for (int y = 0; y < 21; ++y)
+      std::memcpy(window[y], rgb[y + 5] + 7 * 3, 30 * 3);
+    ASSERT_EQ(encoder.encodeToBuffer(view.crop(5, 7, 21, 30), 80, format),
+              encoder.encodeToBuffer(window, 80, format));
+  }
+}
+
+// markers (0xFF followed by a nonzero byte) of a file, stuffed bytes are skipped
+static std::vector<uint8_t> markers(const std::vector<uint8_t> &jpeg) {
+  std::vector<uint8_t> found;
+  for (size_t i = 0; i + 1 < jpeg.size(); ++i) {
+    if (jpeg[i] == 0xFF && jpeg[i + 1] != 0x00) found.push_back(jpeg[++i]);
+  }
+  return found;
+}
+
+// a progressive file is framed by SOF2 and holds one SOS per scan of the script,
+// every output path writes the same bytes; it decodes to the pixels of the baseline
+// file, as both code the same quantized coefficients
+TEST(JpegEncoderTest, progressive_scans) {
+  Image<uint8_t> rgb = gradient_image(37, 53);
+  JpegEncoder encoder;
+  encoder.setVerbose(false);
+  const std::vector<JpegScan> spectral = {
+    {3, {0, 1, 2}, 0, 0, 0, 0},
+    {1, {0}, 1, 63, 0, 0},
+    {1, {1}, 1, 63, 0, 0},
+    {1, {2}, 1, 63, 0, 0},
+  };
+  // successive approximation down from bit 3, with EOB runs and correction bits in
+  // every refinement scan, and a band split across first and refinement scans
+  const std::vector<JpegScan> approximation = {
+    {3, {0, 1, 2}, 0, 0, 0, 2},
+    {1, {0}, 1, 9, 0, 3},
+    {1, {0}, 10, 63, 0, 2},
+    {1, {1}, 1, 63, 0, 1},
+    {1, {2}, 1, 63, 0, 1},
+    {3, {0, 1, 2}, 0, 0, 2, 1},
+    {1, {0}, 1, 9, 3, 2},
+    {1, {0}, 1, 63, 2, 1},
+    {3, {0, 1, 2}, 0, 0, 1, 0},
+    {1, {2}, 1, 63, 1, 0},
+    {1, {1}, 1, 63, 1, 0},
+    {1, {0}, 1, 63, 1, 0},
+  };
+  for (YUVFormat format : {YUVFormat::YUV444, YUVFormat::YUV420, YUVFormat::YUV422}) {
+    std::vector<uint8_t> baseline = encoder.encodeToBuffer(rgb, 75, format);
+    const std::vector<uint8_t> expected = decode_jpeg(baseline, 37, 53);
+    ASSERT_FALSE(expected.empty());
+    ASSERT_GT(psnr(expected, rgb), 30.0);
+    encoder.setProgressive(true);
+    std::vector<uint8_t> jpeg = encoder.encodeToBuffer(rgb, 75, format);
+    ASSERT_EQ(decode_jpeg(jpeg, 37, 53), expected);
+    std::vector<uint8_t> found = markers(jpeg);
+    ASSERT_EQ(std::count(found.begin(), found.end(), 0xC2), 1);
+    ASSERT_EQ(std::count(found.begin(), found.end(), 0xC0), 0);
+    ASSERT_EQ(std::count(found.begin(), found.end(), 0xDA), (long)JpegProgressive::defaultScript().size());
+    ASSERT_EQ(found.front(), 0xD8);
+    ASSERT_EQ(found.back(), 0xD9);
+    ASSERT_NE(jpeg, baseline);
+
+    MemorySink memory;
+    encoder.encodeRGB(rgb, 75, format, memory);
+    ASSERT_EQ(memory.data(), jpeg);
+    std::vector<uint8_t> dst(jpeg.size());
+    ASSERT_EQ(encoder.encodeToBuffer(rgb, 75, format, dst.data(), dst.size()), (long)jpeg.size());
+    ASSERT_EQ(dst, jpeg);
+    ASSERT_EQ(encoder.encodeToBuffer(rgb, 75, format, dst.data(), dst.size() - 1), -1);
+    MemorySink stream;
+    ASSERT_THROW(encoder.encodeRGBStreaming(rgb, 75, format, stream), std::runtime_error);
+
+    encoder.setProgressive(true, spectral);
+    jpeg = encoder.encodeToBuffer(rgb, 75, format);
+    found = markers(jpeg);
+    ASSERT_EQ(std::count(found.begin(), found.end(), 0xDA), 4);
+    ASSERT_EQ(decode_jpeg(jpeg, 37, 53), expected);
+    encoder.setProgressive(true, approximation);
+    jpeg = encoder.encodeToBuffer(rgb, 75, format);
+    found = markers(jpeg);
+    ASSERT_EQ(std::count(found.begin(), found.end(), 0xDA), (long)approximation.size());
+    ASSERT_EQ(decode_jpeg(jpeg, 37, 53), expected);
+    encoder.setProgressive(false);
+    ASSERT_EQ(encoder.encodeToBuffer(rgb, 75, format), baseline);
+  }
+}
+
+TEST(JpegProgressiveTest, invalid_scripts_are_rejected) {
+  JpegProgressive::validateScript(JpegProgressive::defaultScript());
+  const std::vector<std::vector<JpegScan>> invalid = {
+    {{3, {0, 1, 2}, 0, 0, 0, 0}},                                  // AC never coded
+    {{1, {0}, 1, 63, 0, 0}, {3, {0, 1, 2}, 0, 0, 0, 0}},           // AC before DC
+    {{3, {0, 1, 2}, 0, 5, 0, 0}},                                  // DC and AC in one scan
+    {{3, {0, 1, 2}, 0, 0, 0, 1}, {3, {0, 1, 2}, 0, 0, 2, 0}},      // refinement skips a bit
+    {{3, {0, 2, 1}, 0, 0, 0, 0}},                                  // components out of order
+  };
+  for (const auto &script : invalid) {
+    ASSERT_THROW(JpegProgressive::validateScript(script), std::runtime_error);
+  }
+  JpegEncoder encoder;
+  ASSERT_THROW(encoder.setProgressive(true, invalid[0]), std::runtime_error);
+}
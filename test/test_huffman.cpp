@@ -0,0 +1,136 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstring>
+
+#include "HuffmanCodec.hpp"
+using namespace std;
+
+// code lengths of a DHT table must form a prefix code with the all-ones code left free
+static void check_table(const uint8_t *tab, const std::vector<int> &used) {
+  long kraft = 0; // in units of 2^-16
+  int count = 0;
+  for (int l = 1; l <= 16; ++l) {
+    kraft += long(tab[l - 1]) << (16 - l);
+    count += tab[l - 1];
+  }
+  ASSERT_LT(kraft, 1L << 16);
+  ASSERT_GE(count, (int)used.size());
+  for (int s : used) {
+    ASSERT_NE(std::find(tab + 16, tab + 16 + count, s), tab + 16 + count) << "symbol " << s;
+  }
+}
+
+// Fibonacci-like AC statistics over 20 symbols force codes longer than 16 bits before limiting
+TEST(HuffmanCodecTest, optimized_tables_are_length_limited) {
+  std::vector<int> symbols;
+  long a = 1, b = 1;
+  for (int i = 0; i < 20; ++i) {
+    const int run = i / 10, size = i % 10 + 1;
+    for (long c = 0; c < a; ++c) symbols.push_back((run << 4) | size);
+    long t = a + b; a = b; b = t;
+  }
+  std::mt19937 gen(5);
+  std::shuffle(symbols.begin(), symbols.end(), gen);
+
+  // pack the symbols into zigzag ordered blocks
+  std::vector<int16_t> y;
+  int k = 24;
+  for (int s : symbols) {
+    const int run = s >> 4, size = s & 15;
+    if (k + run >= 24) { // sparse enough for the default buffer size
+      y.resize(y.size() + 64, 0);
+      k = 1;
+    }
+    k += run;
+    y[y.size() - 64 + k] = 1 << (size - 1);
+    k++;
+  }
+  const int blocks = y.size() / 64;
+  std::vector<int16_t> uv(size_t(64) * blocks, 0);
+
+  HuffmanCodec codec;
+  const long standard = codec.encode(y.data(), uv.data(), uv.data(), 8 * blocks, 8, YUVFormat::YUV444);
+  codec.optimizeTables(y.data(), uv.data(), uv.data(), 8 * blocks, 8, YUVFormat::YUV444);
+  std::vector<int> used;
+  for (int i = 0; i < 20; ++i) used.push_back(((i / 10) << 4) | (i % 10 + 1));
+  used.push_back(0x00);
+  check_table(codec.huffmanTable(false, true), used);
+  check_table(codec.huffmanTable(true, true), {0});
+
+  const long optimized = codec.encode(y.data(), uv.data(), uv.data(), 8 * blocks, 8, YUVFormat::YUV444);
+  ASSERT_GT(optimized, 0);
+  ASSERT_LT(optimized, standard);
+
+  codec.resetTables();
+  ASSERT_EQ(0, std::memcmp(codec.huffmanTable(false, true), HuffmanCodec::STD_HUFTAB_LUMIN_AC, 16 + 162));
+}
+
+// chunked output of encode() must equal a scan coded into one buffer of worst-case size,
+// for data that is far larger than the first chunk and far above w*h*2 bytes
+TEST(HuffmanCodecTest, chunked_output_matches_contiguous) {
+  std::mt19937 gen(13);
+  std::uniform_int_distribution<int> dis(-1023, 1023);
+  const int w = 256, h = 64, blocks = (w / 8) * (h / 8);
+  std::vector<int16_t> y(size_t(64) * blocks), u(y.size()), v(y.size());
+  for (auto *p : {&y, &u, &v})
+    for (auto &c : *p) c = dis(gen);
+
+  HuffmanCodec codec;
+  const long n = codec.encode(y.data(), u.data(), v.data(), w, h, YUVFormat::YUV444);
+  ASSERT_GT(n, long(w) * h * 2);
+  ASSERT_LE(size_t(n), HuffmanCodec::maxScanBytes(w, h, YUVFormat::YUV444));
+  ASSERT_GT(codec.resultChunks().size(), 1u);
+  const void* first = codec.resultChunks().front().iov_base;
+  ASSERT_EQ(size_t(n), codec.resultSize());
+  std::vector<char> chunked(codec.getResult(), codec.getResult() + n);
+  ASSERT_EQ(size_t(n), codec.resultSize());
+
+  HuffmanCodec reference;
+  reference.beginScan(HuffmanCodec::maxScanBytes(w, h, YUVFormat::YUV444));
+  reference.encodeMcus(y.data(), u.data(), v.data(), blocks, YUVFormat::YUV444);
+  const long m = reference.finishScan();
+  ASSERT_EQ(n, m);
+  ASSERT_EQ(0, std::memcmp(chunked.data(), reference.getResult(), n));
+
+  // the chunks are reused by the next encode
+  ASSERT_EQ(n, codec.encode(y.data(), u.data(), v.data(), w, h, YUVFormat::YUV444));
+  ASSERT_EQ(first, codec.resultChunks().front().iov_base);
+}
+
+// restart intervals coded on the codec's helper threads must match the single-threaded
+// scan, also on the encodes that reuse those threads
+TEST(HuffmanCodecTest, parallel_restarts_match_serial) {
+  std::mt19937 gen(17);
+  std::uniform_int_distribution<int> dis(-64, 64);
+  const int w = 128, h = 128, blocks = (w / 8) * (h / 8);
+  std::vector<int16_t> y(size_t(64) * blocks), u(y.size()), v(y.size());
+  for (auto *p : {&y, &u, &v})
+    for (auto &c : *p) c = dis(gen);
+
+  HuffmanCodec serial, parallel;
+  serial.setRestartInterval(1, 1);
+  parallel.setRestartInterval(1, 4);
+  const long n = serial.encode(y.data(), u.data(), v.data(), w, h, YUVFormat::YUV444);
+  ASSERT_GT(n, 0);
+  std::vector<char> expected(serial.getResult(), serial.getResult() + n);
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_EQ(n, parallel.encode(y.data(), u.data(), v.data(), w, h, YUVFormat::YUV444));
+    ASSERT_EQ(0, std::memcmp(expected.data(), parallel.getResult(), n));
+  }
+}
+
+// the planes encode() reads: MCUs x blocks per MCU luma blocks, one block per MCU of U and V
+TEST(HuffmanCodecTest, block_counts) {
+  size_t luma = 0, chroma = 0;
+  HuffmanCodec::blockCounts(17, 9, YUVFormat::YUV444, luma, chroma);
+  ASSERT_EQ(luma, size_t(6));
+  ASSERT_EQ(chroma, size_t(6));
+  HuffmanCodec::blockCounts(24, 16, YUVFormat::YUV420, luma, chroma);
+  ASSERT_EQ(luma, size_t(8));
+  ASSERT_EQ(chroma, size_t(2));
+  HuffmanCodec::blockCounts(33, 9, YUVFormat::YUV422, luma, chroma);
+  ASSERT_EQ(luma, size_t(12));
+  ASSERT_EQ(chroma, size_t(6));
+}
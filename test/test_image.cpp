@@ -90,11 +90,84 @@ TEST_F(ImageTest, copyFrom) {
 }
 
 TEST_F(ImageTest, roi_sampling) {
+  Image<uint8_t> img(5, 6, 2);
+  for (int y = 0; y < 5; ++y)
+    for (int x = 0; x < 6; ++x) { img(y, x, 0) = 10 * y + x; img(y, x, 1) = 200; }
 
+  // 2x2 averages of channel 1 then channel 0, truncated
+  Image<uint8_t> dst = img.roi_sampling(0, 0, 6, 4, 2, 2, {1, 0});
+  ASSERT_EQ(dst.rows(), 2);
+  ASSERT_EQ(dst.cols(), 3);
+  ASSERT_EQ(dst.channels(), 2);
+  for (int y = 0; y < 2; ++y) {
+    for (int x = 0; x < 3; ++x) {
+      ASSERT_EQ(dst(y, x, 0), 200);
+      const int sum = img(2 * y, 2 * x, 0) + img(2 * y, 2 * x + 1, 0) + img(2 * y + 1, 2 * x, 0) + img(2 * y + 1, 2 * x + 1, 0);
+      ASSERT_EQ(dst(y, x, 1), sum / 4);
+    }
+  }
+
+  // cells reaching outside the image count the missing pixels as 0
+  Image<uint8_t> edge = img.roi_sampling(3, 3, 7, 5, 2, 2, {1});
+  ASSERT_EQ(edge(0, 0, 0), 200); // x 3..4, y 3..4
+  ASSERT_EQ(edge(0, 1, 0), 100); // x 5..6, half outside
+  ASSERT_EQ(img.roi_sampling(0, 4, 2, 6, 2, 2, {1})(0, 0, 0), 100); // y 4..5
+}
+
+TEST_F(ImageTest, view) {
+  Image<uint8_t> img = get_random_image<uint8_t>(5, 40);
+  ImageView<uint8_t> view(img);
+  ASSERT_TRUE(view.contiguous());
+  ASSERT_EQ(view.rows(), img.rows());
+  ASSERT_EQ(view.cols(), img.cols());
+  ASSERT_EQ(view.channels(), img.channels());
+
+  // a window reads the same pixels through the parent's stride
+  const int y0 = 1, x0 = 2, rows = img.rows() - 2, cols = img.cols() - 3;
+  ImageView<uint8_t> window = view.crop(y0, x0, rows, cols);
+  ASSERT_EQ(window.stride(), view.stride());
+  ASSERT_FALSE(window.contiguous());
+  for (int y = 0; y < rows; ++y)
+    for (int x = 0; x < cols; ++x)
+      for (size_t c = 0; c < img.channels(); ++c)
+        ASSERT_EQ(window(y, x, c), img(y + y0, x + x0, c));
+}
+
+TEST_F(ImageTest, access_policy) {
+  Image<uint8_t, CheckedAccess> checked(4, 5, 3);
+  Image<uint8_t, UncheckedAccess> unchecked(4, 5, 3);
+  checked(3, 4, 2) = 7;
+  unchecked(3, 4, 2) = 7;
+  ASSERT_EQ(checked.at(3, 4, 2), 7);
+  ASSERT_EQ(unchecked.at(3, 4, 2), 7);
+  ASSERT_THROW(checked(4, 0, 0), std::out_of_range);
+  ASSERT_THROW(checked[4], std::out_of_range);
+  ASSERT_THROW(checked.get_pixel(0, 0, 3), std::out_of_range);
+  ASSERT_THROW(unchecked.at(0, 5, 0), std::out_of_range); // at() is always checked
+  ASSERT_EQ(checked.get_pixel(-1, 0, 0), 0); // outside the image reads as 0
+
+  // both policies convert to the view the encoder takes
+  ImageView<uint8_t> view(unchecked);
+  ASSERT_EQ(view(3, 4, 2), 7);
+}
+
+TEST_F(ImageTest, row_iteration) {
+  Image<uint8_t> img = get_random_image<uint8_t>(1, 50);
+  size_t y = 0;
+  for (const uint8_t* row : static_cast<const Image<uint8_t>&>(img).rowRange()) {
+    ASSERT_EQ(row, img.row(y));
+    ASSERT_EQ(row, img[y]);
+    ++y;
+  }
+  ASSERT_EQ(y, img.rows());
+
+  ImageView<uint8_t> window = ImageView<uint8_t>(img).crop(0, 0, img.rows(), 1);
+  y = 0;
+  for (const uint8_t* row : window.rowRange()) ASSERT_EQ(row, img.row(y++));
+  ASSERT_EQ(y, img.rows());
 }
 
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
 }
-
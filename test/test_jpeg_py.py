@@ -0,0 +1,186 @@
+#
+# smoke test of the jpeg_py module: build it with -DBUILD_PYTHON_MODULE=ON, then
+#   JPEG_PY_PATH=./build python3 -m pytest test/test_jpeg_py.py
+# needs numpy, Pillow decodes the output when it is installed
+#
+import io
+import os
+import sys
+import threading
+
+import numpy as np
+import pytest
+
+sys.path.insert(0, os.environ.get("JPEG_PY_PATH", "./build"))
+import jpeg_py
+from jpeg_py import YUVFormat
+
+# Annex K tables in DHT layout, as in HuffmanCodec.cpp
+STD_HUFTAB_LUMIN_AC = list(bytes.fromhex(
+    "0002010303020403050504040000017d01020300041105122131410613516107"
+    "227114328191a1082342b1c11552d1f02433627282090a161718191a25262728"
+    "292a3435363738393a434445464748494a535455565758595a63646566676869"
+    "6a737475767778797a838485868788898a92939495969798999aa2a3a4a5a6a7"
+    "a8a9aab2b3b4b5b6b7b8b9bac2c3c4c5c6c7c8c9cad2d3d4d5d6d7d8d9dae1e2"
+    "e3e4e5e6e7e8e9eaf1f2f3f4f5f6f7f8f9fa"))
+STD_HUFTAB_LUMIN_DC = list(bytes.fromhex(
+    "00010501010101010100000000000000000102030405060708090a0b"))
+STD_HUFTAB_CHROM_AC = list(bytes.fromhex(
+    "0002010204040304070504040001027700010203110405213106124151076171"
+    "1322328108144291a1b1c109233352f0156272d10a162434e125f11718191a26"
+    "2728292a35363738393a434445464748494a535455565758595a636465666768"
+    "696a737475767778797a82838485868788898a92939495969798999aa2a3a4a5"
+    "a6a7a8a9aab2b3b4b5b6b7b8b9bac2c3c4c5c6c7c8c9cad2d3d4d5d6d7d8d9da"
+    "e2e3e4e5e6e7e8e9eaf2f3f4f5f6f7f8f9fa"))
+STD_HUFTAB_CHROM_DC = list(bytes.fromhex(
+    "00030101010101010101010000000000000102030405060708090a0b"))
+
+
+def gradient(rows, cols, seed=0):
+    rng = np.random.default_rng(seed)
+    y, x = np.mgrid[0:rows, 0:cols]
+    image = np.stack([y * 255 // rows, x * 255 // cols, (x + y) * 127 // (rows + cols) + 64], axis=2)
+    image = image + rng.integers(-8, 9, size=image.shape)
+    return np.clip(image, 0, 255).astype(np.uint8)
+
+
+def decode(jpeg):
+    Image = pytest.importorskip("PIL.Image")
+    return np.asarray(Image.open(io.BytesIO(jpeg)).convert("RGB"))
+
+
+def is_jpeg(jpeg):
+    return isinstance(jpeg, bytes) and jpeg[:2] == b"\xff\xd8" and jpeg[-2:] == b"\xff\xd9"
+
+
+@pytest.mark.parametrize("fmt", [YUVFormat.YUV444, YUVFormat.YUV420, YUVFormat.YUV422])
+def test_encode_round_trip(fmt):
+    image = gradient(67, 93)
+    jpeg = jpeg_py.encode(image, 90, fmt)
+    assert is_jpeg(jpeg)
+    decoded = decode(jpeg)
+    assert decoded.shape == image.shape
+    assert np.abs(decoded.astype(int) - image).mean() < 4
+
+
+def test_encode_strided_and_image():
+    image = gradient(120, 160)
+    crop = image[10:100, 20:150]
+    assert jpeg_py.encode(crop, 75) == jpeg_py.encode(np.ascontiguousarray(crop), 75)
+    with pytest.raises(ValueError):
+        jpeg_py.encode(image[:, :, :2], 75)
+    with pytest.raises(TypeError):
+        jpeg_py.encode(image.astype(np.float32), 75)
+
+    img = jpeg_py.Image(120, 160, 3)
+    pixels = np.asarray(img)
+    pixels[...] = image  # shares the Image's memory
+    assert (np.asarray(img) == image).all()
+    assert jpeg_py.encode(img, 75) == jpeg_py.encode(image, 75)
+
+
+def test_encoder_context():
+    image = gradient(64, 80)
+    encoder = jpeg_py.Encoder()
+    first = encoder.encode(image, 75, YUVFormat.YUV420)
+    assert first == encoder.encode(image, 75, YUVFormat.YUV420)
+    assert first == jpeg_py.encode(image, 75, YUVFormat.YUV420)
+
+    progressive = jpeg_py.Encoder(optimize_huffman=True, progressive=True).encode(image, 75, YUVFormat.YUV420)
+    assert is_jpeg(progressive) and progressive != first
+    assert np.abs(decode(progressive).astype(int) - decode(first)).max() <= 1
+
+
+def test_encode_batch():
+    images = [gradient(32 + 16 * i, 48 + 8 * i, seed=i) for i in range(9)]
+    expected = [jpeg_py.encode(image, 80, YUVFormat.YUV420) for image in images]
+    assert jpeg_py.encode_batch(images, 80, YUVFormat.YUV420, threads=3) == expected
+    assert jpeg_py.encode_batch(images, 80, YUVFormat.YUV420) == expected
+    assert jpeg_py.encode_batch([], 80) == []
+    with pytest.raises(ValueError):
+        jpeg_py.encode_batch(images + [images[0][:, :, :1]], 80)
+
+
+def test_read_rgb_image_owns_pixels(tmp_path):
+    Image = pytest.importorskip("PIL.Image")
+    image = gradient(40, 50)
+    path = str(tmp_path / "image.png")
+    Image.fromarray(image).save(path)
+
+    pixels = jpeg_py.read_rgb_image(path)
+    assert pixels.shape == (40, 50, 3) and pixels.dtype == np.uint8
+    view = pixels[5:, 7:]
+    del pixels  # the capsule keeps the decoder's buffer alive for the view
+    assert (view == image[5:, 7:]).all()
+    with pytest.raises(RuntimeError):
+        jpeg_py.read_rgb_image(str(tmp_path / "missing.png"))
+
+
+def test_codec_views_block_encode(tmp_path):
+    blocks = np.zeros((4, 64), dtype=np.int16)
+    blocks[:, 0] = [10, -3, 7, 0]
+    codec = jpeg_py.HuffmanCodec()
+    length = codec.encode(blocks, blocks, blocks, 16, 16, YUVFormat.YUV444)
+    assert length > 0
+
+    view = codec.getResult()
+    assert len(view) == length and view.readonly
+    head = codec.getResult(length - 1)
+    assert bytes(head) == bytes(view)[:-1]
+    with pytest.raises(ValueError):
+        codec.getResult(length + 1)
+
+    # the next encode would overwrite the viewed bytes
+    with pytest.raises(BufferError):
+        codec.encode(blocks, blocks, blocks, 16, 16, YUVFormat.YUV444)
+    del view
+    part = head[1:3]
+    del head
+    with pytest.raises(BufferError):  # a slice keeps the export
+        codec.encode(blocks, blocks, blocks, 16, 16, YUVFormat.YUV444)
+    del part
+    assert codec.encode(blocks, blocks, blocks, 16, 16, YUVFormat.YUV444) == length
+
+    quant = [[1] * 64, [1] * 64]
+    ac = [STD_HUFTAB_LUMIN_AC, STD_HUFTAB_CHROM_AC]
+    dc = [STD_HUFTAB_LUMIN_DC, STD_HUFTAB_CHROM_DC]
+    path = str(tmp_path / "scan.jpg")
+    with codec.getResult() as scan:
+        jpeg_py.JpegIO.writeToFile(path, scan, quant, ac, dc, 16, 16, YUVFormat.YUV444)
+    with open(path, "rb") as f:
+        assert decode(f.read()).shape == (16, 16, 3)
+
+
+def test_codec_rejects_mismatched_blocks():
+    codec = jpeg_py.HuffmanCodec()
+    luma = np.zeros((6, 64), dtype=np.int16)  # 24x16 4:2:0: 2 MCUs of 4 luma blocks
+    chroma = np.zeros((2, 64), dtype=np.int16)
+    assert codec.encode(np.zeros((8, 64), dtype=np.int16), chroma, chroma, 24, 16, YUVFormat.YUV420) > 0
+    with pytest.raises(ValueError):
+        codec.encode(luma, chroma, chroma, 24, 16, YUVFormat.YUV420)
+    with pytest.raises(ValueError):
+        codec.encode(np.zeros((8, 64), dtype=np.int16), chroma[:1], chroma, 24, 16, YUVFormat.YUV420)
+    with pytest.raises(ValueError):
+        codec.encode(luma[:, :32], chroma, chroma, 24, 16, YUVFormat.YUV420)
+    for width, height in [(0, 16), (24, -8)]:
+        with pytest.raises(ValueError):
+            codec.encode(luma, chroma, chroma, width, height, YUVFormat.YUV420)
+
+
+def test_encode_releases_gil():
+    image = gradient(2048, 2048)
+    done = []
+    worker = threading.Thread(target=lambda: done.append(jpeg_py.encode(image, 75)))
+    interval = sys.getswitchinterval()
+    # with a 10 s switch interval this thread only runs during the encode if the GIL is released
+    sys.setswitchinterval(10)
+    try:
+        ticks = 0
+        worker.start()
+        while worker.is_alive():
+            ticks += 1
+        worker.join()
+    finally:
+        sys.setswitchinterval(interval)
+    assert is_jpeg(done[0])
+    assert ticks > 1000
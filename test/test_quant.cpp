@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <random>
+#include <cmath>
+
+#include "JpegQuant.hpp"
+#include "JpegZigzag.hpp"
+using namespace std;
+
+// reciprocal quantization must equal round-half-away-from-zero division, in zigzag order
+TEST(JpegQuantTest, quantZigzag_matches_division) {
+  std::mt19937 gen(11);
+  std::uniform_int_distribution<int> dis(-1100, 1100);
+  for (int quality : {1, 10, 50, 75, 95, 100}) {
+    for (bool baseline : {true, false}) {
+      JpegQuant quant(quality, baseline);
+      for (bool luminance : {true, false}) {
+        const std::vector<int> &qtab = luminance ? quant.qtable_lumin : quant.qtable_chrom;
+        const int n = 17;
+        std::vector<int16_t> dct(64 * n), fast(64 * n);
+        for (auto &v : dct) v = dis(gen);
+        for (int i = 0; i < 64; ++i) dct[i] = (i & 1) ? 1024 : -1024; // extremes
+        quant.quantZigzagBlocks(dct.data(), fast.data(), n, luminance);
+        for (int b = 0; b < n; ++b) {
+          int16_t ref[64];
+          quant.quantZigzag8x8(dct.data() + b * 64, ref, luminance);
+          for (int k = 0; k < 64; ++k) {
+            const int c = dct[b * 64 + JpegZigzag::ZIGZAG_INDEX[k]];
+            const int q = qtab[JpegZigzag::ZIGZAG_INDEX[k]];
+            const int expected = (c < 0 ? -1 : 1) * ((std::abs(c) + q / 2) / q);
+            ASSERT_EQ(ref[k], expected) << "q=" << quality << " k=" << k;
+            ASSERT_EQ(fast[b * 64 + k], expected) << "q=" << quality << " k=" << k;
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(JpegQuantTest, in_place) {
+  JpegQuant quant(50, true);
+  std::vector<int16_t> dct(64), out(64);
+  for (int i = 0; i < 64; ++i) dct[i] = 10 * i - 300;
+  quant.quantZigzagBlocks(dct.data(), out.data(), 1, true);
+  quant.quantZigzagBlocks(dct.data(), dct.data(), 1, true);
+  ASSERT_EQ(dct, out);
+}
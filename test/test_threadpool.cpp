@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <chrono>
+
+#include "JpegThreadPool.hpp"
+#include "JpegQueue.hpp"
+using namespace std;
+
+// every task runs exactly once, on a valid worker, including tasks queued by tasks
+TEST(JpegThreadPoolTest, runs_every_task_once) {
+  JpegThreadPool pool(4);
+  ASSERT_EQ(pool.size(), 4);
+  const int n = 2000;
+  std::vector<std::atomic<int>> runs(2 * n);
+  for (auto &r : runs) r = 0;
+  std::atomic<int> badWorker(0);
+  for (int i = 0; i < n; ++i) {
+    pool.submit([&, i](int worker) {
+      if (worker < 0 || worker >= 4) badWorker++;
+      runs[i]++;
+      pool.submit([&, i](int) { runs[n + i]++; });
+    });
+  }
+  pool.wait();
+  ASSERT_EQ(badWorker, 0);
+  for (int i = 0; i < 2 * n; ++i) ASSERT_EQ(runs[i], 1) << i;
+
+  // the pool is reusable after wait
+  std::atomic<int> count(0);
+  for (int i = 0; i < 100; ++i) pool.submit([&](int) { count++; });
+  pool.wait();
+  ASSERT_EQ(count, 100);
+}
+
+// a slow worker's queue is drained by the others
+TEST(JpegThreadPoolTest, idle_workers_steal) {
+  JpegThreadPool pool(3);
+  std::vector<std::atomic<int>> perWorker(3);
+  for (auto &w : perWorker) w = 0;
+  pool.submit([&](int) {
+    // queued on this worker's own deque, the others must steal them
+    for (int i = 0; i < 300; ++i) {
+      pool.submit([&](int w) {
+        perWorker[w]++;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  });
+  pool.wait();
+  int helpers = 0;
+  for (auto &w : perWorker) helpers += w > 0;
+  ASSERT_GE(helpers, 2);
+}
+
+TEST(JpegThreadPoolTest, rethrows_task_exception) {
+  JpegThreadPool pool(2);
+  std::atomic<int> count(0);
+  for (int i = 0; i < 10; ++i) {
+    pool.submit([&, i](int) {
+      count++;
+      if (i == 3) throw std::runtime_error("task failed");
+    });
+  }
+  ASSERT_THROW(pool.wait(), std::runtime_error);
+  ASSERT_EQ(count, 10);
+  pool.submit([&](int) { count++; });
+  pool.wait();
+  ASSERT_EQ(count, 11);
+}
+
+// a producer never runs more than the capacity ahead of the consumer, and close
+// lets the consumer drain what is left
+TEST(JpegQueueTest, bounded_and_closable) {
+  JpegQueue<std::unique_ptr<int>> queue(3);
+  std::atomic<int> pushed(0);
+  std::thread producer([&]() {
+    for (int i = 0; i < 100; ++i) {
+      queue.push(std::unique_ptr<int>(new int(i)));
+      pushed++;
+    }
+    queue.close();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_LE(pushed, 3);
+
+  std::unique_ptr<int> item;
+  int expected = 0;
+  while (queue.pop(item)) {
+    ASSERT_EQ(*item, expected++);
+    ASSERT_LE(pushed - expected, 3);
+  }
+  producer.join();
+  ASSERT_EQ(expected, 100);
+  ASSERT_FALSE(queue.push(std::unique_ptr<int>(new int(0))));
+}